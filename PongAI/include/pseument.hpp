@@ -16,8 +16,12 @@
 using namespace std;
 using namespace Eigen;
 
+template <int... Sizes> class StaticNetwork;
+
 class NeuralNetwork {
 
+    template <int... Sizes> friend class StaticNetwork;   // Copies the trained layers
+
 private:
 
     vector<DenseLayer> layers;
@@ -0,0 +1,186 @@
+#ifndef STATICNETWORK_HPP
+#define STATICNETWORK_HPP
+
+#include "Eigen/Dense"
+#include "pseument.hpp"
+
+#include <fstream>
+#include <iostream>
+#include <string>
+
+using namespace std;
+using namespace Eigen;
+
+// Fixed-size layers In -> Out -> Rest..., each one the weights and bias of a DenseLayer. Every size
+// is known at compile time, so the matrices live inline (no heap) and the compiler unrolls the products
+template <int In, int Out, int... Rest>
+struct StaticLayers {
+
+    Matrix<double, Out, In> w = Matrix<double, Out, In>::Zero();
+    Matrix<double, Out, 1> b = Matrix<double, Out, 1>::Zero();
+    StaticLayers<Out, Rest...> next;
+
+    typedef typename StaticLayers<Out, Rest...>::Output Output;
+
+    Output forward(const Matrix<double, In, 1>& in) const {
+
+        // Leaky ReLU like DenseLayer::forward
+        const Matrix<double, Out, 1> z = w * in + b;
+        return next.forward(z.cwiseMax(0.01 * z));
+
+    }
+
+    // Checkpoints hold every weight matrix (row by row), then every bias
+    bool readWeights(istream& file) {
+
+        for (int r = 0; r < Out; r++)
+            for (int c = 0; c < In; c++)
+                file >> w(r, c);
+        return bool(file) && next.readWeights(file);
+
+    }
+
+    bool readBiases(istream& file) {
+
+        for (int r = 0; r < Out; r++)
+            file >> b(r);
+        return bool(file) && next.readBiases(file);
+
+    }
+
+    // Weights of layers[l] and every layer after it, false when a shape differs
+    bool copy(const vector<DenseLayer>& layers, size_t l) {
+
+        if (l >= layers.size() || layers[l].w.rows() != Out || layers[l].w.cols() != In)
+            return false;
+        w = layers[l].w;
+        b = layers[l].b;
+        return next.copy(layers, l + 1);
+
+    }
+
+};
+
+template <int In, int Out>
+struct StaticLayers<In, Out> {
+
+    Matrix<double, Out, In> w = Matrix<double, Out, In>::Zero();
+    Matrix<double, Out, 1> b = Matrix<double, Out, 1>::Zero();
+
+    typedef Matrix<double, Out, 1> Output;
+
+    Output forward(const Matrix<double, In, 1>& in) const {
+
+        const Output z = w * in + b;
+        return z.cwiseMax(0.01 * z);
+
+    }
+
+    bool readWeights(istream& file) {
+
+        for (int r = 0; r < Out; r++)
+            for (int c = 0; c < In; c++)
+                file >> w(r, c);
+        return bool(file);
+
+    }
+
+    bool readBiases(istream& file) {
+
+        for (int r = 0; r < Out; r++)
+            file >> b(r);
+        return bool(file);
+
+    }
+
+    bool copy(const vector<DenseLayer>& layers, size_t l) {
+
+        if (l + 1 != layers.size() || layers[l].w.rows() != Out || layers[l].w.cols() != In)
+            return false;
+        w = layers[l].w;
+        b = layers[l].b;
+        return true;
+
+    }
+
+};
+
+// Inference-only network with its topology in the type, e.g. StaticNetwork<6, 8, 1> for the Pong
+// player. It computes what NeuralNetwork::forward does for the same weights, without any allocation,
+// and loads the checkpoints NeuralNetwork::save writes
+template <int... Sizes>
+class StaticNetwork {
+
+    static_assert(sizeof...(Sizes) >= 2, "A network needs an input and at least one layer");
+
+public:
+
+    static constexpr int layer_count = sizeof...(Sizes);
+    static constexpr int sizes[layer_count] = {Sizes...};
+
+    typedef Matrix<double, sizes[0], 1> Input;
+    typedef Matrix<double, sizes[layer_count - 1], 1> Output;
+
+    Output forward(const Input& in) const {
+
+        return layers.forward(in);
+
+    }
+
+    Output forward(const double* in) const {
+
+        return layers.forward(Map<const Input>(in));
+
+    }
+
+    // False (with a message) when the file is missing or holds another topology
+    bool load(const string& filename) {
+
+        ifstream file(filename);
+        if (!file) {
+            cerr << "File couldn't be accessed for loading\n";
+            return false;
+        }
+
+        int count = 0;
+        file >> count;
+        bool match = count == layer_count;
+        for (int l = 0; l < count && file; l++) {
+            int size = 0;
+            file >> size;
+            match = match && size == sizes[l];
+        }
+        if (!match) {
+            cerr << "Network in " << filename << " doesn't have the layer sizes of this StaticNetwork\n";
+            return false;
+        }
+
+        // Read into a copy so a truncated file leaves the current weights alone
+        StaticLayers<Sizes...> loaded;
+        if (!loaded.readWeights(file) || !loaded.readBiases(file)) {
+            cerr << "Network in " << filename << " is incomplete\n";
+            return false;
+        }
+        layers = loaded;
+        return true;
+
+    }
+
+    // Copies the weights of a live network (after it trains), false when its topology differs
+    bool load(const NeuralNetwork& nn) {
+
+        StaticLayers<Sizes...> copied;
+        if (!copied.copy(nn.layers, 1))
+            return false;
+        layers = copied;
+        return true;
+
+    }
+
+private:
+
+    StaticLayers<Sizes...> layers;
+
+};
+
+#endif // STATICNETWORK_HPP
@@ -7,6 +7,7 @@
 #include <deque>
 
 #include "pseument.hpp"
+#include "staticnetwork.hpp"
 #include "SFML/Graphics.hpp"
 #include "SFML/Window.hpp"
 #include "SFML/System.hpp"
@@ -32,6 +33,8 @@ bool display = true;
 bool printEpochs = true;
 
 NeuralNetwork nn({6, 8, 1});
+StaticNetwork<6, 8, 1> player;  // Fixed size copy of nn for the per-frame decision, refreshed when nn changes
+bool playerReady = false;       // False when a loaded network has another topology, nn decides then
 std::vector<double> inputs;
 std::vector<std::vector<double>> X;
 std::vector<std::vector<double>> Y;
@@ -96,6 +99,7 @@ int main(int argc, char* argv[]) {
         std::cout << "Loading network: " << filename << "\n";
         nn.load("../data/arc/" + filename + ".txt");
     }
+    playerReady = player.load(nn);
 
     sf::RenderWindow window(sf::VideoMode(WINDOW_WIDTH, WINDOW_HEIGHT), "", sf::Style::None);
     window.setTitle("Pong " + std::to_string(leftScore) + " to " + std::to_string(rightScore) + "  |  AI WR: " + 
@@ -177,12 +181,12 @@ int main(int argc, char* argv[]) {
             }
             
             // Decide which direction to move
-            std::vector<double> output = nn.forward(inputs);
+            double output = playerReady ? player.forward(inputs.data())(0) : nn.forward(inputs)[0];
 
-            if (output[0] > 0.5 && rightPaddle.getPosition().y > 0) {
+            if (output > 0.5 && rightPaddle.getPosition().y > 0) {
                 rightPaddle.velocity = -10;
             }
-            else if (output[0] <= 0.5 && rightPaddle.getPosition().y + PADDLE_HEIGHT < WINDOW_HEIGHT) {
+            else if (output <= 0.5 && rightPaddle.getPosition().y + PADDLE_HEIGHT < WINDOW_HEIGHT) {
                 rightPaddle.velocity = 10;
             }
 
@@ -238,6 +242,7 @@ int main(int argc, char* argv[]) {
                             Y.push_back({0});
                     }
                     nn.train(X, Y, epochs, batchSize, trainingSpeed, printEpochs);
+                    playerReady = player.load(nn);
                     X.clear();
                     Y.clear();
                 }
@@ -208,11 +208,13 @@ void NeuralNetwork::load(const string& filename) {
         return;
     }
 
-    // Load layers
-    uint layer_size;
-    file >> layer_size;
-    layers.resize(layer_size);
-    for (uint l = 0; l < layer_size; l++) {
+    // Load layers (the layer count, then every layer's size)
+    uint layer_count;
+    file >> layer_count;
+    layers.resize(layer_count);
+    for (uint l = 0; l < layer_count; l++) {
+        uint layer_size;
+        file >> layer_size;
         if(l == 0) 
             layers[l] = DenseLayer(layer_size, 0);
         else 
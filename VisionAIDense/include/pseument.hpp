@@ -83,8 +83,17 @@ private:
         return x.unaryExpr([alpha](double v) { return v > 0 ? 1 : alpha; });
     }
 
+    // Same derivative as an unevaluated expression, so it can scale deltas without a temporary
+    static auto leakyReluSlope(const VectorXd& x, double alpha = 0.01) {
+        return (x.array() > 0).select(1.0, ArrayXd::Constant(x.size(), alpha));
+    }
+
     void initializeAdamMiniStates();
 
+    // Forward pass into caller owned activations and z values (lets every Hogwild thread keep its own).
+    // Takes any column view and allocates nothing once acts and zs have their sizes
+    void forwardInto(const Ref<const VectorXd>& input, vector<VectorXd>& acts, vector<VectorXd>& zs);
+
 public:
 
     NeuralNetwork(const vector<int>& layers);
@@ -107,6 +116,11 @@ public:
     void train(vector<vector<double>>& X, vector<vector<double>>& Y, int& epochs, 
         int& batch_size, double& learning_rate, bool print);
 
+    // Asynchronous lock-free SGD (Hogwild!): threads train on single samples and write straight into
+    // the shared weights and biases. threads <= 0 uses every hardware thread
+    void trainHogwild(vector<vector<double>>& X, vector<vector<double>>& Y, int& epochs, 
+        double& learning_rate, int threads, bool print);
+
     void save(const string& filename);
     void load(const string& filename);
 
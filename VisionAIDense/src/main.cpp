@@ -30,6 +30,7 @@ bool training = false;
 bool fast = false;
 bool dSDisplay = false;
 bool printEpochs = true;
+bool hogwild = false; // Lock-free multithreaded SGD instead of mini-batch AdamW
 
 vector<vector<double>> images;
 vector<double> labels;
@@ -152,7 +153,10 @@ int main(int argc, char* argv[]) {
                     Y[Y.size() - 1][labels[i + trained]] = 1;
                     trained++;
                 }
-                nn.train(X, Y, epochs, batchSize, trainingSpeed, printEpochs);
+                if(hogwild)
+                    nn.trainHogwild(X, Y, epochs, trainingSpeed, 0, printEpochs);
+                else
+                    nn.train(X, Y, epochs, batchSize, trainingSpeed, printEpochs);
                 X.clear();
                 Y.clear();
             }
@@ -283,6 +287,18 @@ void keyBoardInputs() {
         F = false;
     }
 
+    // Toggle Hogwild Training
+    if (sf::Keyboard::isKeyPressed(sf::Keyboard::H)) {
+        if(!H) {
+            hogwild = !hogwild;
+            cout << (hogwild ? "Hogwild training\n" : "Mini-batch training\n");
+        }
+        H = true;
+    }
+    else {
+        H = false;
+    }
+
     // Print Network Information
     if (sf::Keyboard::isKeyPressed(sf::Keyboard::N)) {
         if(!N) {
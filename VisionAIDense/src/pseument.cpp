@@ -5,6 +5,10 @@
 
 #include "pseument.hpp"
 
+#include <atomic>
+#include <chrono>
+#include <thread>
+
 void NeuralNetwork::initializeAdamMiniStates() {
 
     m_weights.resize(weights.size());
@@ -87,28 +91,35 @@ int NeuralNetwork::forward(const vector<double>& input) {
 
 VectorXd NeuralNetwork::forward(const VectorXd& input) {
 
+    forwardInto(input, activations, z_vals);
+
+    // Return the output of the last layer
+    return activations.back();
+
+}
+
+void NeuralNetwork::forwardInto(const Ref<const VectorXd>& input, vector<VectorXd>& acts, vector<VectorXd>& zs) {
+
     if(debugging)
         cout << "Started forward\n";
 
     // Set the first layer of activations to the input values
-    activations[0] = input;
+    acts[0] = input;
 
     // Iterate through each layer starting from layer 1 (since layer 0 is input)
     for (size_t l = 1; l < layers.size(); ++l) {
 
         // Calculate z-values for the current layer
-        z_vals[l] = weights[l] * activations[l - 1] + biases[l];
+        zs[l].noalias() = weights[l] * acts[l - 1];
+        zs[l] += biases[l];
 
-        // Apply the activation function to z-values
-        activations[l] = leakyRelu(z_vals[l]);
+        // Apply the activation function (leaky ReLU) to z-values, in place
+        acts[l] = zs[l].cwiseMax(0.01 * zs[l]);
     }
 
     if(debugging)
         cout << "Finished forward " << "\n";
 
-    // Return the output of the last layer
-    return activations.back();
-
 }
 
 void NeuralNetwork::getOutputDeltas(vector<VectorXd>& deltas, const VectorXd& target) {
@@ -317,6 +328,8 @@ void NeuralNetwork::train(vector<vector<double>>& X, vector<vector<double>>& Y,
     // Iterate over epochs (passes through dataset)
     for (int epoch = 0; epoch < epochs; ++epoch) {
 
+        auto start = chrono::steady_clock::now();
+
         // Shuffle Order
         shuffle(shuffled.begin(), shuffled.end(), g);
 
@@ -350,9 +363,10 @@ void NeuralNetwork::train(vector<vector<double>>& X, vector<vector<double>>& Y,
             stepAdamW(avg_grad_w, avg_grad_b, learning_rate, batch_size); 
         }
 
-        // Print accuracy at every epoch
+        // Print accuracy and time at every epoch
         if (print) {
-            cout << "Epoch " << epoch + 1 << ": " << correct << " / " << tested << "\n";
+            double secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            cout << "Epoch " << epoch + 1 << ": " << correct << " / " << tested << " (" << secs << "s)\n";
         }
 
         // cout << "First Hidden Weight Connections: \n";
@@ -367,6 +381,121 @@ void NeuralNetwork::train(vector<vector<double>>& X, vector<vector<double>>& Y,
 }
 
 
+void NeuralNetwork::trainHogwild(vector<vector<double>>& X, vector<vector<double>>& Y, 
+        int& epochs, double& learning_rate, int threads, bool print) {
+
+    if(debugging)
+        cout << "Started trainHogwild\n";
+
+    if (threads <= 0)
+        threads = max(1u, thread::hardware_concurrency());
+
+    int numSamples = X.size();
+
+    // One column per sample so a thread reads its input contiguously
+    MatrixXd inputs(X[0].size(), numSamples);
+    MatrixXd targets(Y[0].size(), numSamples);
+    for (int i = 0; i < numSamples; ++i) {
+        for (uint j = 0; j < X[i].size(); ++j)
+            inputs(j, i) = X[i][j];
+        for (uint j = 0; j < Y[i].size(); ++j)
+            targets(j, i) = Y[i][j];
+    }
+
+    // Item Order
+    vector<int> shuffled(numSamples);
+    iota(shuffled.begin(), shuffled.end(), 0);
+
+    random_device rd;
+    mt19937 g(rd());
+
+    const size_t out = layers.size() - 1;
+
+    for (int epoch = 0; epoch < epochs; ++epoch) {
+
+        auto start = chrono::steady_clock::now();
+
+        shuffle(shuffled.begin(), shuffled.end(), g);
+
+        atomic<int> next(0);
+        atomic<int> n_correct(0);
+
+        auto worker = [&]() {
+
+            // Thread local activations, z values and deltas, only weights and biases are shared
+            vector<VectorXd> acts(layers.size()), zs(layers.size()), deltas(layers.size());
+            for (size_t l = 0; l < layers.size(); ++l) {
+                acts[l] = VectorXd::Zero(layers[l]);
+                zs[l] = VectorXd::Zero(layers[l]);
+                deltas[l] = VectorXd::Zero(layers[l]);
+            }
+
+            int local_correct = 0;
+            const int chunk = 64;
+
+            for (int begin = next.fetch_add(chunk); begin < numSamples; begin = next.fetch_add(chunk)) {
+                int end = min(begin + chunk, numSamples);
+                for (int i = begin; i < end; ++i) {
+
+                    int s = shuffled[i];
+                    forwardInto(inputs.col(s), acts, zs);
+
+                    Index guess, ans;
+                    acts.back().maxCoeff(&guess);
+                    targets.col(s).maxCoeff(&ans);
+                    if (guess == ans)
+                        local_correct++;
+
+                    // Deltas are written in place into the thread's buffers, so a sample allocates nothing
+                    deltas[out].array() = (acts[out] - targets.col(s)).array() * leakyReluSlope(zs[out]);
+                    for (size_t l = out - 1; l > 0; --l) {
+                        deltas[l].noalias() = weights[l + 1].transpose() * deltas[l + 1];
+                        deltas[l].array() *= leakyReluSlope(zs[l]);
+                    }
+
+                    // Updates go straight into the shared parameters without locks. Races only lose the odd
+                    // update, which SGD tolerates, and the first layer only touches the columns of lit pixels
+                    for (size_t l = out; l > 1; --l) {
+                        weights[l].noalias() -= learning_rate * deltas[l] * acts[l - 1].transpose();
+                        biases[l] -= learning_rate * deltas[l];
+                    }
+                    for (Index j = 0; j < acts[0].size(); ++j) {
+                        if (acts[0](j) != 0)
+                            weights[1].col(j) -= (learning_rate * acts[0](j)) * deltas[1];
+                    }
+                    biases[1] -= learning_rate * deltas[1];
+                }
+            }
+
+            n_correct += local_correct;
+
+        };
+
+        // The calling thread works as one of the workers
+        vector<thread> workers;
+        for (int k = 1; k < threads; ++k)
+            workers.emplace_back(worker);
+        worker();
+        for (thread& w : workers)
+            w.join();
+
+        correct = n_correct;
+        tested = numSamples;
+
+        // Print accuracy and time at every epoch
+        if (print) {
+            double secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            cout << "Epoch " << epoch + 1 << ": " << correct << " / " << tested << " (" << secs << "s, " 
+                << threads << " threads)\n";
+        }
+    }
+
+    if(debugging)
+        cout << "Finished trainHogwild\n";
+
+}
+
+
 void NeuralNetwork::save(const string& filename) {
 
     // Open/create file
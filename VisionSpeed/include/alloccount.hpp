@@ -0,0 +1,16 @@
+#ifndef ALLOCCOUNT_HPP
+#define ALLOCCOUNT_HPP
+
+#include <cstddef>
+
+// Opt-in heap allocation counter, compiled in with PSEUMENT_COUNT_ALLOCS.
+// On glibc every malloc is counted (Eigen and operator new both go through it),
+// elsewhere only operator new is seen.
+bool allocCountEnabled();
+size_t allocCount();
+
+// Stops counting allocations made by the calling thread, for background threads that aren't part
+// of a training step (evaluation monitors)
+void allocCountIgnoreThread();
+
+#endif
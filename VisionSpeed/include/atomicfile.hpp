@@ -0,0 +1,18 @@
+#ifndef ATOMICFILE_HPP
+#define ATOMICFILE_HPP
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Replaces path with the concatenation of parts, all or nothing. The data goes to a temporary file
+// with a name unique to this call, is flushed with fsync and renamed over path, then the directory
+// is flushed so the rename survives a crash too. Concurrent writers to the same path (threads or
+// processes) never share a temporary file, whichever rename comes last wins with a complete file.
+// Returns false on failure, with path left as it was
+bool writeFileAtomic(const string& path, const char* const* parts, const size_t* lengths, size_t count);
+bool writeFileAtomic(const string& path, const vector<char>& data);
+
+#endif
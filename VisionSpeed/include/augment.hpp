@@ -0,0 +1,63 @@
+#ifndef AUGMENT_HPP
+#define AUGMENT_HPP
+
+#include "layer.hpp"
+#include "threadpool.hpp"
+
+#include <memory>
+#include <random>
+#include <vector>
+
+using namespace std;
+using namespace Eigen;
+
+// Random distortions applied to every training image (all zero turns augmentation off)
+struct Augment {
+    size_t rows = 28;        // Shape of one image column
+    size_t cols = 28;
+    size_t chans = 1;
+    Scalar shift = 2;        // Largest translation in pixels (sub-pixel amounts included)
+    Scalar rotate = 0.25;    // Largest rotation in radians
+    Scalar scale = 0.1;      // Largest relative zoom in or out
+    Scalar elastic = 1.5;    // Largest elastic displacement in pixels
+    size_t grid = 4;         // Control points per axis of the smooth elastic field
+    size_t threads = 2;      // Workers resampling the batch
+};
+
+// Warps a batch of images in place. Random parameters come from one generator in sample order,
+// so a seeded run is reproducible, and the resampling itself runs on a small pool.
+class Augmenter {
+
+public:
+
+    Augmenter(const Augment& cfg);
+
+    void prepare(size_t bs);                     // Sizes the buffers for batches of bs samples
+    void apply(MatrixXs& batch, mt19937& rng);   // Replaces every column with a warped copy
+    size_t imageSize() const;
+
+private:
+
+    struct Scratch {
+        ArrayXs sr, sc;                 // Source coordinates of every output pixel
+        MatrixXs half;                  // Elastic grid interpolated along the columns only
+        Array<Index, Dynamic, 1> tap;   // Index of the top left bilinear tap of every pixel in padded
+        ArrayXs padded;                 // Source channel inside a zero border, so no tap needs a bounds check
+    };
+
+    Augment cfg;
+    unique_ptr<ThreadPool> pool;
+    vector<Scratch> scratch;
+
+    ArrayXs dr, dc;                 // Pixel offsets from the image centre
+    MatrixXs ry, rc;                // Interpolation weights of the elastic control rows (columns) for every image row (column)
+
+    vector<Scalar> params;          // Per sample: cos, sin, shift r, shift c, then the grid displacements
+    MatrixXs warped;
+
+    size_t paramSize() const;
+    void warp(const Scalar* src, Scalar* dst, const Scalar* p, Scratch& s) const;
+
+};
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef BATCHLOADER_HPP
+#define BATCHLOADER_HPP
+
+#include "augment.hpp"
+#include "dataview.hpp"
+#include "layer.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <random>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using namespace Eigen;
+
+// Prepares mini-batches on its own thread while the network trains on the previous one.
+// Batches live in a ring of preallocated slots handed over through a lock-free single producer,
+// single consumer queue: the loader fills slot head, the trainer reads slot tail and releases it.
+class BatchLoader {
+
+public:
+
+    struct Batch {
+        MatrixXs in, tg;   // One column per sample
+    };
+
+    // Produces epochs * ceil(count / bs) batches, reshuffling at the start of every epoch with a generator
+    // seeded by epochSeed(seed, first_epoch + epoch) (the last batch of an epoch wraps around to the start,
+    // like NeuralNetwork::train). With an augmenter the inputs are also warped here, off the training thread
+    BatchLoader(const DataView& X, const DataView& Y, size_t bs, size_t epochs, uint64_t seed, size_t first_epoch, 
+        size_t depth = 2, Augmenter* aug = nullptr);
+    ~BatchLoader();
+
+    BatchLoader(const BatchLoader&) = delete;
+    BatchLoader& operator=(const BatchLoader&) = delete;
+
+    const Batch& next();   // Waits only if the loader fell behind
+    void release();        // Hands the slot returned by next back to the loader
+
+    // Seed of the random numbers used in one epoch of a run. Every epoch only depends on the run seed and
+    // its index, so a checkpoint taken between epochs resumes with exactly the same data order
+    static uint32_t epochSeed(uint64_t seed, uint64_t epoch);
+
+private:
+
+    DataView X, Y;
+    size_t bs, epochs;
+    uint64_t seed;
+    size_t first_epoch;
+    mt19937 rng;
+    Augmenter* aug;
+
+    vector<Batch> slots;
+    vector<int> order, idx;
+
+    alignas(64) atomic<size_t> head{0};   // Batches produced
+    alignas(64) atomic<size_t> tail{0};   // Batches released
+    atomic<bool> stopping{false};
+
+    thread worker;
+
+    void produce();
+
+};
+
+#endif
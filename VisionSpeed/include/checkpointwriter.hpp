@@ -0,0 +1,46 @@
+#ifndef CHECKPOINTWRITER_HPP
+#define CHECKPOINTWRITER_HPP
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// Writes checkpoint images on a background thread so training keeps going while the disk works.
+// Every file is written with writeFileAtomic, so a crash at any point leaves either the old
+// checkpoint or the new one, never half of one.
+class CheckpointWriter {
+
+public:
+
+    CheckpointWriter();
+    ~CheckpointWriter();   // Finishes a pending write first
+
+    CheckpointWriter(const CheckpointWriter&) = delete;
+    CheckpointWriter& operator=(const CheckpointWriter&) = delete;
+
+    bool busy();
+
+    vector<char>& acquire();            // Waits for the previous write, then hands out the buffer to fill
+    void submit(const string& path);    // Writes the acquired buffer to path
+    void wait();
+
+private:
+
+    thread worker;
+    mutex mtx;
+    condition_variable cv;
+
+    vector<char> buf;
+    string path;
+    bool pending = false;
+    bool stopping = false;
+
+    void workerLoop();
+
+};
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef CONFIG_HPP
+#define CONFIG_HPP
+
+// Eigen settings the whole stack relies on. Every header includes this before Eigen, so the apps in
+// mains/ and the tools get the same build as CMake without extra flags. They have to be seen before
+// Eigen's first include in a translation unit
+#ifdef EIGEN_CORE_H
+#error "Include config.hpp (or any Pseument header) before Eigen"
+#endif
+
+// Let Eigen keep its GEMM packing buffers on the stack so training steps don't allocate
+#ifndef EIGEN_STACK_ALLOCATION_LIMIT
+#define EIGEN_STACK_ALLOCATION_LIMIT 1048576
+#endif
+
+// Start every Eigen heap buffer on a 64 byte boundary (a cache line), which the parameter arenas and
+// packed models rely on. Eigen only guarantees 16 bytes without AVX
+#ifndef EIGEN_MAX_ALIGN_BYTES
+#define EIGEN_MAX_ALIGN_BYTES 64
+#endif
+
+// Arena layouts pad every layer to 64 bytes, which only lands on cache lines when the arenas
+// themselves start on one
+#if EIGEN_MAX_ALIGN_BYTES < 64
+#error "Build with EIGEN_MAX_ALIGN_BYTES=64"
+#endif
+
+#endif
@@ -1,6 +1,7 @@
 #ifndef CONVOLAYER_HPP
 #define CONVOLAYER_HPP
 
+#include "config.hpp"
 #include "Eigen/Dense"
 #include "layer.hpp"
 
@@ -11,27 +12,47 @@ class ConvoLayer : public Layer {
 
 public:
 
+    // Every batch column is one sample stored channel by channel, each channel a column-major plane
     size_t in_rows = 0;
     size_t in_cols = 0;
+    size_t in_chans = 1;
 
     size_t out_rows = 0;
     size_t out_cols = 0;
+    size_t out_chans = 1;
 
     size_t k_size = 0;
-    MatrixXd kernel;
+    size_t stride = 1;
+    size_t padding = 0;
+
+    // im2col buffers, reused across batches: every column holds the k x k x in_chans input patch under
+    // one output pixel of one sample, so the convolution becomes a matrix multiply with the filter bank w
+    // (one filter per row, out_chans x k*k*in_chans)
+    MatrixXs patches;
+    MatrixXs d_patches;
+    MatrixXs dz_t;     // dz with one row per output channel (out_chans x out_px * batch)
+    MatrixXs w_flip;   // Filters flipped and with the channel roles swapped, for the input gradient
+    VectorXs b_px;   // Channel biases repeated over every output pixel
 
     ConvoLayer();
     ConvoLayer(vector<size_t> in_size, vector<size_t> out_size, string af, size_t ks);
 
-    MatrixXd convolve(const MatrixXd& in, const size_t out_rows, const size_t out_cols, const MatrixXd& k);
-
-    MatrixXd forward(const MatrixXd& in) override;
-    void getOutputDeltas(const MatrixXd& target) override;
-    void backward(const MatrixXd& w_next, const MatrixXd& d_next) override;
-    void updateGrads(const MatrixXd& in) override;
-    void stepSGD(const double& lr, const size_t& bs) override;
-    void stepAdamW(const double& lr, const size_t& bs, size_t& t) override;
+    void im2col(const MatrixXs& src, size_t rows, size_t cols, size_t chans, size_t o_rows, size_t o_cols, size_t s, MatrixXs& dst) const;
+    static void im2col(const MatrixXs& src, size_t rows, size_t cols, size_t chans, size_t o_rows, size_t o_cols, 
+        size_t ks, size_t pad, size_t s, MatrixXs& dst);
+    void channelMajorDeltas();
+    void col2im(MatrixXs& d_in);
+
+    const MatrixXs& forward(const MatrixXs& in) override;
+    void infer(const MatrixXs& in, MatrixXs& out, MatrixXs& scratch) const override;
+    void getOutputDeltas(const Ref<const MatrixXs>& target) override;
+    void inputGrad(MatrixXs& d_in) override;
+    void updateGrads(const MatrixXs& in) override;
+    size_t paramCount() override;
+    void bind(Scalar* p, Scalar* g) override;
+    void initParams(mt19937& rng) override;
     pair<size_t, size_t> size() override;
+    unique_ptr<Layer> clone() const override;
     
     ~ConvoLayer() = default;
 };
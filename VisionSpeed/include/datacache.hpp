@@ -0,0 +1,77 @@
+#ifndef DATACACHE_HPP
+#define DATACACHE_HPP
+
+#include "dataview.hpp"
+#include "layer.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Pre-processed dataset cache (.psd). Samples are stored normalized and packed (bytes with a scale, or
+// float16) behind a small index header, followed by the class labels. Opening one is a single memory
+// map, so every training process on a machine shares the same page cached data.
+//
+// The header records a fingerprint of the IDX files the cache was built from (see fresh), so stale
+// caches can be rebuilt, and a checksum of everything after the header (see verify). Verifying reads
+// the whole payload, so opening never does it, only mkcache --verify and openOrBuild after a build.
+class DataCache {
+
+public:
+
+    enum class Encoding : uint32_t { u8 = 0, f16 = 1 };
+
+    DataCache() = default;
+    DataCache(const string& path);
+    ~DataCache();
+
+    DataCache(const DataCache&) = delete;
+    DataCache& operator=(const DataCache&) = delete;
+
+    void open(const string& path);   // Throws runtime_error on a missing or malformed cache
+    void close();
+
+    // Converts an IDX image file and its label file into a cache at path
+    static void build(const string& images, const string& labels, const string& path, 
+        size_t classes = 10, Encoding enc = Encoding::u8);
+
+    // Opens the cache at path, (re)building it first when it's missing, malformed, older than the
+    // sources or of another class count or encoding. Throws runtime_error when the build fails
+    void openOrBuild(const string& images, const string& labels, const string& path, 
+        size_t classes = 10, Encoding enc = Encoding::u8);
+
+    bool fresh(const string& images, const string& labels) const;   // Built from these files as they are now
+    bool verify() const;                                             // Recomputes the checksum
+
+    size_t items() const;
+    size_t itemSize() const;
+    size_t classes() const;
+    Encoding encoding() const;
+
+    vector<Scalar> sample(size_t i) const;
+
+    // Views for NeuralNetwork::train, the inputs and the one-hot labels
+    DataView view() const;
+    DataView oneHot() const;
+
+private:
+
+    const uint8_t* bytes = nullptr;
+    void* mapped = nullptr;
+    size_t mapped_len = 0;
+    vector<uint8_t> copy;            // File contents where mmap isn't available
+
+    const void* data = nullptr;      // First sample
+    const uint8_t* labels = nullptr;
+    size_t n_items = 0, item_size = 0, n_classes = 0;
+    Encoding enc = Encoding::u8;
+    Scalar scale = 1;
+
+    uint64_t stamp = 0, checksum = 0;
+    size_t payload_offset = 0;
+
+};
+
+#endif
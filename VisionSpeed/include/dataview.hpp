@@ -0,0 +1,41 @@
+#ifndef DATAVIEW_HPP
+#define DATAVIEW_HPP
+
+#include "layer.hpp"
+
+#include <cstdint>
+
+using namespace std;
+using namespace Eigen;
+
+// Non-owning view of a dataset stored sample after sample: sample i starts stride values after
+// sample i - 1 and holds size values. Nothing is copied until gather fills a batch.
+struct DataView {
+
+    enum class Type { scalar, u8, f16, label };
+
+    const void* data = nullptr;
+    size_t count = 0;    // Samples
+    size_t size = 0;     // Values per sample (classes for label views)
+    size_t stride = 0;   // Values from one sample to the next
+    Type type = Type::scalar;
+    Scalar scale = 1;    // u8 and f16 values are multiplied by this
+
+    DataView() = default;
+    DataView(const Scalar* d, size_t n, size_t sz, size_t st = 0);
+    DataView(const uint8_t* d, size_t n, size_t sz, size_t st = 0, Scalar sc = Scalar(1.0 / 255));
+    DataView(const Eigen::half* d, size_t n, size_t sz, size_t st = 0, Scalar sc = 1);
+    DataView(const MatrixXs& m);   // One sample per column
+
+    // Class indices stored as bytes, gathered as one-hot columns. Throws runtime_error when a label
+    // isn't below classes
+    static DataView oneHot(const uint8_t* d, size_t n, size_t classes, size_t st = 1);
+
+    DataView slice(size_t first, size_t n) const;
+
+    // out.col(b) = sample idx[b] for every b < n
+    void gather(const int* idx, size_t n, MatrixXs& out) const;
+
+};
+
+#endif
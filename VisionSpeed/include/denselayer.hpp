@@ -1,6 +1,7 @@
 #ifndef DENSELAYER_HPP
 #define DENSELAYER_HPP
 
+#include "config.hpp"
 #include "Eigen/Dense"
 #include "layer.hpp"
 
@@ -12,17 +13,21 @@ class DenseLayer : public Layer {
 public:
 
     size_t l_size = 0;
+    size_t in_size = 0;
 
     DenseLayer();
     DenseLayer(size_t ls, size_t in_size, string afn);
 
-    MatrixXd forward(const MatrixXd& in) override;
-    void getOutputDeltas(const MatrixXd& target) override;
-    void backward(const MatrixXd& w_next, const MatrixXd& d_next) override;
-    void updateGrads(const MatrixXd& in) override;
-    void stepSGD(const double& lr, const size_t& bs) override;
-    void stepAdamW(const double& lr, const size_t& bs, size_t& t) override;
+    const MatrixXs& forward(const MatrixXs& in) override;
+    void infer(const MatrixXs& in, MatrixXs& out, MatrixXs& scratch) const override;
+    void getOutputDeltas(const Ref<const MatrixXs>& target) override;
+    void inputGrad(MatrixXs& d_in) override;
+    void updateGrads(const MatrixXs& in) override;
+    size_t paramCount() override;
+    void bind(Scalar* p, Scalar* g) override;
+    void initParams(mt19937& rng) override;
     pair<size_t, size_t> size() override;
+    unique_ptr<Layer> clone() const override;
     
     ~DenseLayer() = default;
 };
@@ -0,0 +1,86 @@
+#ifndef EVALUATOR_HPP
+#define EVALUATOR_HPP
+
+#include "dataview.hpp"
+#include "layer.hpp"
+#include "threadpool.hpp"
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using namespace Eigen;
+
+// Result of running a network over a held-out dataset
+struct Evaluation {
+
+    size_t samples = 0;
+    size_t correct = 0;
+    double accuracy = 0;
+    double loss = 0;                  // Mean of 0.5 * |output - target|^2, the loss train minimizes
+    double samples_per_sec = 0;
+    size_t epoch = 0;                 // Epochs trained when the weights were taken
+    Matrix<size_t, Dynamic, Dynamic> confusion;   // confusion(true class, predicted class)
+
+    void print(bool matrix = false) const;
+
+};
+
+// Batched inference over a dataset through the layers' const infer. run evaluates the layers it is
+// given on the calling thread and a small pool. start copies the weights and evaluates that snapshot
+// on a background thread, so training can keep changing its own weights in the meantime.
+class Evaluator {
+
+public:
+
+    Evaluator(size_t threads);
+    ~Evaluator();
+
+    Evaluator(const Evaluator&) = delete;
+    Evaluator& operator=(const Evaluator&) = delete;
+
+    Evaluation run(const vector<unique_ptr<Layer>>& layers, const DataView& X, const DataView& Y, size_t bs);
+
+    // False while the previous background evaluation is still running
+    bool start(const vector<unique_ptr<Layer>>& layers, const vector<size_t>& offsets, const Scalar* params, size_t count, 
+        const DataView& X, const DataView& Y, size_t bs, size_t epoch);
+    size_t size() const;
+    bool busy();
+    bool ready();                     // A finished background result hasn't been collected yet
+    Evaluation result();              // Collects it (waits for a running evaluation)
+
+private:
+
+    // Activations and batch buffers of one task
+    struct Worker {
+        Workspace ws;
+        MatrixXs tg;
+        vector<int> idx;
+        size_t correct = 0;
+        double loss = 0;
+        Matrix<size_t, Dynamic, Dynamic> confusion;
+    };
+
+    unique_ptr<ThreadPool> pool;
+    size_t threads;
+    vector<Worker> workers;
+
+    // Background evaluation
+    thread background;
+    mutex mtx;
+    condition_variable cv;
+    VectorXs snapshot;
+    vector<unique_ptr<Layer>> snapshot_layers;   // Copies of the layers bound to snapshot
+    DataView bg_x, bg_y;
+    size_t bg_bs = 0, bg_epoch = 0;
+    bool running = false, finished = false, stopping = false;
+    Evaluation last;
+
+    void backgroundLoop();
+
+};
+
+#endif
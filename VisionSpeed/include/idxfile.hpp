@@ -0,0 +1,53 @@
+#ifndef IDXFILE_HPP
+#define IDXFILE_HPP
+
+#include "dataview.hpp"
+#include "layer.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Read-only view of an IDX file (MNIST, Fashion-MNIST, EMNIST, ...). The file is memory mapped and
+// the unsigned byte samples stay as they are, they only become Scalars when a batch is filled.
+class IdxFile {
+
+public:
+
+    IdxFile() = default;
+    IdxFile(const string& path);
+    ~IdxFile();
+
+    IdxFile(const IdxFile&) = delete;
+    IdxFile& operator=(const IdxFile&) = delete;
+
+    void open(const string& path);   // Throws runtime_error on a missing or malformed file
+    void close();
+
+    size_t items() const;                       // First dimension (images or labels)
+    size_t itemSize() const;                    // Bytes per item (product of the other dimensions)
+    const vector<size_t>& dims() const;
+    const uint8_t* item(size_t i) const;
+
+    // Writes count items starting at first into out as values in [0, 1], one item after another
+    void normalize(size_t first, size_t count, Scalar* out) const;
+    vector<Scalar> sample(size_t i) const;
+
+    // Views for NeuralNetwork::train: the samples scaled to [0, 1], or the items as one-hot labels
+    DataView view() const;
+    DataView oneHot(size_t classes) const;
+
+private:
+
+    const uint8_t* data = nullptr;   // First item
+    void* mapped = nullptr;
+    size_t mapped_len = 0;
+    vector<uint8_t> copy;            // File contents where mmap isn't available
+    vector<size_t> dim;
+    size_t item_size = 0;
+
+};
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef INFERENCEMODEL_HPP
+#define INFERENCEMODEL_HPP
+
+#include "config.hpp"
+#include "Eigen/Dense"
+#include "layer.hpp"
+
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace Eigen;
+
+class NeuralNetwork;
+
+// A trained network reduced to what inference needs: its weights, packed into one buffer, and the
+// shape of every layer. Activations, deltas, gradients, moments and replicas are all left behind.
+// Layers become plain stages run through one switch (no virtual call per layer), and every stage adds
+// its bias and applies its activation in the same pass that writes its output. This is what serving
+// processes load, from NeuralNetwork::freeze or straight from a checkpoint
+class InferenceModel {
+
+public:
+
+    InferenceModel(const NeuralNetwork& nn);
+    InferenceModel(const string& fn);   // Binary or text checkpoint, throws runtime_error if it can't be loaded
+
+    // Same contract as NeuralNetwork::forwardBatch, shared by any number of threads with a workspace each
+    const MatrixXs& forwardBatch(const Ref<const MatrixXs>& in, Workspace& ws) const;
+
+    size_t inputSize() const;
+    size_t outputSize() const;
+    size_t bytes() const;               // Memory held by the model, weights and stage descriptions
+
+private:
+
+    enum class Kind { dense, convo, pool };
+
+    struct Stage {
+        Kind kind;
+        Layer::ActFunc act;
+        bool max_pool;                  // Pooling mode, average otherwise
+        Index in_rows, in_cols, in_chans;
+        Index out_rows, out_cols, out_chans;
+        Index k_size, stride, padding;  // Kernel of convolutions, window (k_size = stride) of pooling
+        Index w_rows, w_cols;
+        Index w_at, b_at;               // Offsets into weights
+    };
+
+    vector<Stage> stages;
+    // Every stage's weights and bias. The buffer is 64 byte aligned (EIGEN_MAX_ALIGN_BYTES, set in
+    // config.hpp) and every stage starts a multiple of 64 bytes into it, so each one begins a cache line
+    VectorXs weights;
+    Index in_size = 0;
+
+    void pack(const NeuralNetwork& nn);
+    void dense(const Stage& st, const MatrixXs& in, MatrixXs& out) const;
+    void convo(const Stage& st, const MatrixXs& in, MatrixXs& out, MatrixXs& scratch) const;
+
+};
+
+#endif
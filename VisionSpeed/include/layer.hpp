@@ -1,90 +1,159 @@
 #ifndef LAYER_HPP
 #define LAYER_HPP
 
+#include "config.hpp"
 #include "Eigen/Dense"
 
-#include <functional>
 #include <iostream>
+#include <memory>
+#include <new>
+#include <random>
+#include <vector>
 
 using namespace Eigen;
 using namespace std;
 
+// Precision of the whole network (build with PSEUMENT_FLOAT for single precision)
+#ifdef PSEUMENT_FLOAT
+typedef float Scalar;
+#else
+typedef double Scalar;
+#endif
+
+typedef Matrix<Scalar, Dynamic, Dynamic> MatrixXs;
+typedef Matrix<Scalar, Dynamic, 1> VectorXs;
+typedef Array<Scalar, Dynamic, 1> ArrayXs;
+
+// Caller-owned buffers for inference through const layers (see Layer::infer). Every thread keeps its
+// own, and once sized by the first batch they are reused without allocating
+struct Workspace {
+    vector<MatrixXs> acts;      // Output of every layer, acts[0] is the input
+    vector<MatrixXs> scratch;   // One per layer (im2col patches), so differently sized layers never reallocate
+};
+
 class Layer {
 
 public:
 
-    MatrixXd w, b, z, a;
-    MatrixXd dz, avg_grad_w, avg_grad_b;
-    MatrixXd m_w, v_w, m_b, v_b;
+    // Views into the network's flat parameter and gradient arenas (see bind)
+    Map<MatrixXs> w{nullptr, 0, 0}, b{nullptr, 0, 0};
+    Map<MatrixXs> avg_grad_w{nullptr, 0, 0}, avg_grad_b{nullptr, 0, 0};
 
-    double beta1 = 0.9;       // Exponential decay rate for first moment
-    double beta2 = 0.999;     // Exponential decay rate for second moment
-    double epsilon = 1e-8;   // Small constant to avoid division by zero
-    double lambda = 0.0;     // Weight decay coefficient (Set to 1% of learning rate)
+    MatrixXs a, dz;
+
+    enum class ActFunc { leakyrelu, sigmoid, tanh, linear };
 
     string a_func_name = "leakyrelu";
-    function<MatrixXd(const MatrixXd&)> a_func;
-    function<MatrixXd(const MatrixXd&)> a_func_deri;
+    ActFunc a_func = ActFunc::leakyrelu;
 
     void setActFunc(const std::string& func_name) {
 
         a_func_name = func_name;
 
-        if (func_name == "leakyrelu") {
-            a_func = [](const MatrixXd& x) {
-                return x.unaryExpr([](double v) {
-                    return v > 0 ? v : 0.01 * v;
-                });
-            };
-            a_func_deri = [](const MatrixXd& x) {
-                return x.unaryExpr([](double v) { 
-                    return v > 0 ? 1 : 0.01; 
-                });
-            };
-        } 
-
-        else if (func_name == "sigmoid") {
-            a_func = [](const MatrixXd& x) {
-                return x.unaryExpr([](double v) {
-                    return 1.0 / (1.0 + exp(-v)); 
-                });
-            };
-            a_func_deri = [](const MatrixXd& x) {
-                return x.unaryExpr([](double v) {
-                    double sig = 1.0 / (1.0 + exp(-v));
-                    return sig * (1.0 - sig);
-                });
-            };
-        } 
-
-        else if (func_name == "tanh") {
-            a_func = [](const MatrixXd& x) {
-                return x.unaryExpr([](double v) { 
-                    return std::tanh(v); 
-                });
-            };
-            a_func_deri = [](const MatrixXd& x) {
-                return x.unaryExpr([](double v) {
-                    double t = std::tanh(v);
-                    return 1.0 - t * t;
-                });
-            };
+        if (func_name == "leakyrelu")
+            a_func = ActFunc::leakyrelu;
+        else if (func_name == "sigmoid")
+            a_func = ActFunc::sigmoid;
+        else if (func_name == "tanh")
+            a_func = ActFunc::tanh;
+        else if (func_name == "linear")
+            a_func = ActFunc::linear;
+        else
+            throw std::invalid_argument("Unknown activation function");
+
+    }
+
+    // Adds the bias to every column of x and applies the activation in the same pass (x = f(x + bias))
+    template <typename Bias>
+    void biasActivate(MatrixXs& x, const MatrixBase<Bias>& bias) const {
+
+        activate(x, (x.colwise() + bias).array());
+
+    }
+
+    // x = f(v), v may read x itself since the activation works coefficient by coefficient
+    template <typename Values>
+    void activate(MatrixXs& x, const ArrayBase<Values>& v) const {
+
+        activate(a_func, x, v);
+
+    }
+
+    // Same for any activation and any destination (blocks and maps of a bigger matrix too)
+    template <typename Dst, typename Values>
+    static void activate(ActFunc f, Dst& x, const ArrayBase<Values>& v) {
+
+        switch (f) {
+            case ActFunc::leakyrelu:
+                x = v.max(Scalar(0.01) * v);
+                break;
+            case ActFunc::sigmoid:
+                x = (Scalar(1) + (-v).exp()).inverse();
+                break;
+            case ActFunc::tanh:
+                x = v.tanh();
+                break;
+            case ActFunc::linear:
+                x = v;
+                break;
         }
 
-        else {
-            throw std::invalid_argument("Unknown activation function");
+    }
+
+    // Multiplies d by f'(z) in place, using the cached activation a instead of z
+    void applyActFuncDeri(MatrixXs& d) {
+
+        switch (a_func) {
+            case ActFunc::leakyrelu:
+                d = (a.array() > 0).select(d, Scalar(0.01) * d);
+                break;
+            case ActFunc::sigmoid:
+                d.array() *= a.array() * (Scalar(1) - a.array());
+                break;
+            case ActFunc::tanh:
+                d.array() *= Scalar(1) - a.array().square();
+                break;
+            case ActFunc::linear:
+                break;
         }
 
     }
 
-    virtual MatrixXd forward(const MatrixXd& in) = 0;
-    virtual void getOutputDeltas(const MatrixXd& target) = 0;
-    virtual void backward(const MatrixXd& w_next, const MatrixXd& d_next) = 0;
-    virtual void updateGrads(const MatrixXd& in) = 0;
-    virtual void stepSGD(const double& lr, const size_t& bs) = 0;
-    virtual void stepAdamW(const double& lr, const size_t& bs, size_t& t) = 0;
+    // Re-seats w, b and their gradients onto memory owned by the network
+    void bindParams(Scalar* p, Scalar* g, Index w_rows, Index w_cols, Index b_rows, Index b_cols) {
+
+        new (&w) Map<MatrixXs>(p, w_rows, w_cols);
+        new (&b) Map<MatrixXs>(p + w_rows * w_cols, b_rows, b_cols);
+        new (&avg_grad_w) Map<MatrixXs>(g, w_rows, w_cols);
+        new (&avg_grad_b) Map<MatrixXs>(g + w_rows * w_cols, b_rows, b_cols);
+
+    }
+
+    // All layer data is batched: every column of in, a and dz is one sample
+    virtual const MatrixXs& forward(const MatrixXs& in) = 0;
+
+    // Same output as forward, but written to out and scratch instead of the layer's own buffers, so
+    // any number of threads can run one shared layer at once
+    virtual void infer(const MatrixXs& in, MatrixXs& out, MatrixXs& scratch) const = 0;
+    virtual void getOutputDeltas(const Ref<const MatrixXs>& target) = 0;
+    virtual void inputGrad(MatrixXs& d_in) = 0;   // Gradient of the loss with respect to this layer's input (from dz)
+    virtual void updateGrads(const MatrixXs& in) = 0;
+    virtual size_t paramCount() = 0;
+    virtual void bind(Scalar* p, Scalar* g) = 0;
+    virtual void initParams(mt19937& rng) = 0;   // Fresh weights drawn from rng
     virtual pair<size_t, size_t> size() = 0;
 
+    // Deltas of this layer from the layer that consumes its output
+    void backward(Layer& next) {
+
+        next.inputGrad(dz);
+        applyActFuncDeri(dz);
+
+    }
+
+    // Copy that shares nothing with this layer until it is bound (used for per-thread replicas)
+    virtual unique_ptr<Layer> clone() const = 0;
+
     virtual ~Layer() = default;
     
 };
@@ -0,0 +1,52 @@
+#ifndef POOLLAYER_HPP
+#define POOLLAYER_HPP
+
+#include "config.hpp"
+#include "Eigen/Dense"
+#include "layer.hpp"
+
+using namespace std;
+using namespace Eigen;
+
+// Max or average pooling over non-overlapping windows, channel by channel (no parameters)
+class PoolLayer : public Layer {
+
+public:
+
+    size_t in_rows = 0;
+    size_t in_cols = 0;
+
+    size_t out_rows = 0;
+    size_t out_cols = 0;
+
+    size_t chans = 1;
+    size_t p_size = 2;   // Window size and stride
+
+    string mode = "max";
+    bool max_pool = true;                     // mode == "max", decided once so the pixel loops don't compare strings
+    Matrix<Index, Dynamic, Dynamic> argmax;   // Input index picked for every output of the last forward (max mode)
+
+    // The pooling kernel, shared with InferenceModel. picked receives the input index that won every
+    // max window (nullptr when nothing goes backward)
+    void pool(const MatrixXs& in, MatrixXs& out, Matrix<Index, Dynamic, Dynamic>* picked) const;
+    static void pool(const MatrixXs& in, size_t rows, size_t cols, size_t chans, size_t o_rows, size_t o_cols, 
+        size_t p, bool max_pool, MatrixXs& out, Matrix<Index, Dynamic, Dynamic>* picked);
+
+    PoolLayer();
+    PoolLayer(vector<size_t> in_size, vector<size_t> out_size, string md);
+
+    const MatrixXs& forward(const MatrixXs& in) override;
+    void infer(const MatrixXs& in, MatrixXs& out, MatrixXs& scratch) const override;
+    void getOutputDeltas(const Ref<const MatrixXs>& target) override;
+    void inputGrad(MatrixXs& d_in) override;
+    void updateGrads(const MatrixXs& in) override;
+    size_t paramCount() override;
+    void bind(Scalar* p, Scalar* g) override;
+    void initParams(mt19937& rng) override;
+    pair<size_t, size_t> size() override;
+    unique_ptr<Layer> clone() const override;
+    
+    ~PoolLayer() = default;
+};
+
+#endif
@@ -1,8 +1,21 @@
 #ifndef PSEUMENT_H
 #define PSEUMENT_H
 
+#include "alloccount.hpp"
+#include "augment.hpp"
+#include "batchloader.hpp"
+#include "checkpointwriter.hpp"
 #include "convolayer.hpp"
+#include "dataview.hpp"
 #include "denselayer.hpp"
+#include "evaluator.hpp"
+#include "inferencemodel.hpp"
+#include "poollayer.hpp"
+#include "quantize.hpp"
+#include "quantlayer.hpp"
+#include "shardstream.hpp"
+#include "threadpool.hpp"
+#include "config.hpp"
 #include "Eigen/Dense"
 
 #include <algorithm>
@@ -12,6 +25,8 @@
 #include <cmath>
 #include <random>
 #include <cstdlib>
+#include <cstring>
+#include <cstdint>
 #include <ctime>
 #include <memory>
 
@@ -44,16 +59,44 @@ struct MakeLayer {
             o_size[0] = l_size[0];
             o_size[1] = l_size[1];
         }
+        // Pooling halves the image by default, afn picks "max" or "avg"
+        if(l_type == 2 && o_size[0] == 0 && o_size[1] == 0) {
+            o_size[0] = l_size[0] / 2;
+            o_size[1] = l_size[1] / 2;
+        }
+        // Convolution and pooling sizes are {rows, cols, channels}, a missing channel count means one plane
+        if(l_type == 1 || l_type == 2) {
+            l_size.resize(3, 1);
+            o_size.resize(3, 1);
+        }
 
     };
 };
 
 class NeuralNetwork {
 
+    friend class QuantizedNetwork;    // Read the trained layers and their weights
+    friend class InferenceModel;
+
 private:
 
     vector<unique_ptr<Layer>> layers;
 
+    // Flat arenas holding every trainable tensor, layer after layer (layers keep Map views into them).
+    // params views either param_store or the blob of a memory mapped checkpoint
+    VectorXs param_store;
+    Map<VectorXs> params{nullptr, 0};
+    VectorXs grads;
+    VectorXs m, v;               // AdamW moments, laid out like params
+
+    void* mapped = nullptr;      // Checkpoint mapping backing params (see load)
+    size_t mapped_len = 0;
+
+    Scalar beta1 = 0.9;       // Exponential decay rate for first moment
+    Scalar beta2 = 0.999;     // Exponential decay rate for second moment
+    Scalar epsilon = 1e-8;   // Small constant to avoid division by zero
+    Scalar lambda = 0.0;     // Weight decay coefficient (Set to 1% of learning rate)
+
     size_t descent = 0;
     size_t t = 0;
     size_t tested = 0;
@@ -61,22 +104,112 @@ private:
 
     bool debugging = false;
 
+    // Per-thread copy of the layers for data parallel training. Every replica reads the shared
+    // params but accumulates into its own gradient arena (replica 0 uses grads directly)
+    struct Replica {
+        vector<unique_ptr<Layer>> layers;
+        VectorXs grads;
+        size_t tested = 0;
+        size_t correct = 0;
+    };
+
+    vector<size_t> offsets;      // Start of each layer in the arenas
+    vector<Replica> replicas;
+    unique_ptr<ThreadPool> pool;
+    size_t threads = 1;
+    bool prefetch = true;         // Assemble batches on a loader thread (see BatchLoader)
+    // Run seed, together with the epoch index it fixes the data order and augmentation of every epoch
+    // (see BatchLoader::epochSeed), so resuming from a checkpoint repeats exactly what training would have done
+    uint64_t seed = uint64_t(random_device{}()) << 32 | random_device{}();
+    size_t trained = 0;               // Epochs trained so far, across train calls
+    bool params_fresh = false;        // Weights are still the initial draw, which setSeed redraws
+    mt19937 rng;                      // Generator of the current epoch when batches are assembled inline
+
+    // Background checkpoints (see setCheckpoint and saveAsync)
+    unique_ptr<CheckpointWriter> writer;
+    string checkpoint_path;
+    size_t checkpoint_every = 0;
+    size_t checkpointed = 0;          // Epoch of the last background checkpoint
+
+    // Held-out evaluation: evaluator runs on the live weights with the training threads, monitor
+    // evaluates weight snapshots on a background thread (see evaluateAsync and setMonitor)
+    unique_ptr<Evaluator> evaluator;
+    unique_ptr<Evaluator> monitor;
+    DataView monitor_x, monitor_y;
+    size_t monitor_every = 0;
+
+    unique_ptr<Augmenter> augmenter;  // Distorts training inputs (see setAugment)
+
+    // Batch buffers reused across steps and train calls
+    MatrixXs batch_in, batch_tg;
+    MatrixXs pack_x, pack_y;
+    vector<int> batch_idx;
+
+    size_t layoutArena();
+    void buildArena();
+    void initParams();
+    void bindLayers();
+    void prepareTraining();
+    void unmap();
+    void buildReplicas();
+    void forwardLayers(vector<unique_ptr<Layer>>& ls, const Ref<const MatrixXs>& in);
+    void outputDeltas(vector<unique_ptr<Layer>>& ls, const Ref<const MatrixXs>& target, size_t& n_tested, size_t& n_correct);
+    void backwardLayers(vector<unique_ptr<Layer>>& ls);
+    void parallelStep(const MatrixXs& batch_in, const MatrixXs& batch_tg);
+    void beginTraining(Scalar& lr, const string& da);
+    void backpropBatch(const MatrixXs& in, const MatrixXs& tg);
+    void updateParams(Scalar& lr, size_t& bs);
+    void printEpoch(size_t epoch, size_t steps, size_t step_allocs);
+    void finishEpoch(bool print);
+    void serialize(vector<char>& out);
+
 public:
 
     NeuralNetwork(const vector<MakeLayer>& layers);
-
-    vector<double> forward(const vector<double>& in);
-    VectorXd forward(const VectorXd& in);
-    void getOutputDeltas(const VectorXd& target);
+    ~NeuralNetwork();
+
+    vector<Scalar> forward(const vector<Scalar>& in);
+    const MatrixXs& forward(const MatrixXs& in);
+    // Inference only: leaves the layers untouched and keeps every activation in ws, one sample per column
+    const MatrixXs& forwardBatch(const Ref<const MatrixXs>& in, Workspace& ws) const;
+    InferenceModel freeze() const;     // Copy of the weights without any training state, for serving
+    void getOutputDeltas(const MatrixXs& target);
     void backward();
-    void stepSGD(double& lr, size_t& bs);
-    void stepAdamW(double& lr, size_t& bs, size_t& t);
-
-    void train(vector<vector<double>>& X, vector<vector<double>>& Y, size_t& epochs, 
-        size_t& bs, double& lr, string da, bool print);
-
+    void stepSGD(Scalar& lr, size_t& bs);
+    void stepAdamW(Scalar& lr, size_t& bs, size_t& t);
+
+    void setThreads(size_t n);
+    void setSeed(unsigned s);
+    void setPrefetch(bool on);
+    void setAugment(const Augment& cfg);
+    void clearAugment();
+
+    void train(vector<vector<Scalar>>& X, vector<vector<Scalar>>& Y, size_t& epochs, 
+        size_t& bs, Scalar& lr, string da, bool print);
+    void train(const DataView& X, const DataView& Y, size_t& epochs, 
+        size_t& bs, Scalar& lr, string da, bool print);
+    void train(ShardStream& S, size_t& epochs, size_t& bs, Scalar& lr, string da, bool print);
+
+    // save writes the binary checkpoint, load reads it (memory mapped) or imports the text format.
+    // Binary checkpoints carry the whole training state (moments, step counter, seed and epoch), and
+    // saveAsync writes one on a background thread from a snapshot taken at the call (save waits for
+    // it first, so the two never finish out of order)
     void save(const string& fn);
+    void saveAsync(const string& fn);
+    void setCheckpoint(const string& fn, size_t every);   // Checkpoint to fn every few epochs while training, 0 stops
+    void waitForSave();
+    size_t epochsTrained();
     void load(const string& fn);
+    void saveText(const string& fn);
+    void loadBinary(const string& fn);
+    void loadText(const string& fn);
+
+    // Accuracy, loss, confusion matrix and throughput on held-out data, nothing is trained
+    Evaluation evaluate(const DataView& X, const DataView& Y, size_t bs = 250);
+    bool evaluateAsync(const DataView& X, const DataView& Y, size_t bs = 250);   // False while one is still running
+    bool evaluationReady();
+    Evaluation lastEvaluation();
+    void setMonitor(const DataView& X, const DataView& Y, size_t every);        // Background evaluation every few epochs, 0 stops
 
     vector<size_t> getLayerSizes();
 
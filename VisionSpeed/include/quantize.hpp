@@ -0,0 +1,43 @@
+#ifndef QUANTIZE_HPP
+#define QUANTIZE_HPP
+
+#include "dataview.hpp"
+#include "evaluator.hpp"
+#include "layer.hpp"
+#include "quantlayer.hpp"
+
+#include <memory>
+#include <vector>
+
+using namespace std;
+using namespace Eigen;
+
+class NeuralNetwork;
+
+// Post-training int8 copy of a network for inference. Dense layers become QuantLayers, with the
+// input range of each found by running the float network over calibration samples. Convolution and
+// pooling layers keep a float copy of their weights. The source network can change or go away after
+class QuantizedNetwork {
+
+public:
+
+    QuantizedNetwork(const NeuralNetwork& nn, const DataView& calib, size_t samples = 2000, size_t threads = 1);
+
+    // Same contract as NeuralNetwork::forwardBatch, shared by any number of threads with a workspace each
+    const MatrixXs& forwardBatch(const Ref<const MatrixXs>& in, Workspace& ws) const;
+    Evaluation evaluate(const DataView& X, const DataView& Y, size_t bs = 250);
+
+    size_t quantizedLayers() const;
+    size_t weightBytes() const;       // Memory of the weights as stored here
+    size_t sourceBytes() const;       // Memory the same weights take in the source network
+
+private:
+
+    vector<unique_ptr<Layer>> layers;
+    vector<VectorXs> float_params;    // Weights of the layers kept in floating point
+    size_t source_bytes = 0;
+    unique_ptr<Evaluator> evaluator;
+
+};
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef QUANTLAYER_HPP
+#define QUANTLAYER_HPP
+
+#include "config.hpp"
+#include "Eigen/Dense"
+#include "denselayer.hpp"
+#include "layer.hpp"
+
+#include <cstdint>
+
+using namespace std;
+using namespace Eigen;
+
+// Int8 copy of a trained DenseLayer for inference. Every output row keeps its own weight scale, the
+// input is quantized with the range found by calibration (see QuantizedNetwork). Inputs use 7 bit
+// codes (0 - 127) so a pair of products never saturates vpmaddubsw, and every kernel returns the
+// same integers. Only infer works, the layer can't be trained
+class QuantLayer : public Layer {
+
+public:
+
+    size_t l_size = 0;
+    size_t in_size = 0;
+    size_t k_pad = 0;                              // in_size rounded up to the 64 byte kernel step
+
+    Matrix<int8_t, Dynamic, Dynamic, RowMajor> qw;   // One padded row of weight codes per output
+    VectorXs row_scale;                            // Value of one accumulator step, input scale times the row's weight scale
+    VectorXs row_offset;                           // Bias minus the share of the input zero point, added with the activation
+
+    Scalar in_lo = 0, in_hi = 1;                   // Calibrated input range
+    Scalar in_scale = 1;
+    int32_t in_zero = 0;                           // Code of an input of 0
+
+    QuantLayer();
+    QuantLayer(const DenseLayer& src, Scalar lo, Scalar hi);
+
+    void infer(const MatrixXs& in, MatrixXs& out, MatrixXs& scratch) const override;
+    const MatrixXs& forward(const MatrixXs& in) override;
+    void getOutputDeltas(const Ref<const MatrixXs>& target) override;
+    void inputGrad(MatrixXs& d_in) override;
+    void updateGrads(const MatrixXs& in) override;
+    size_t paramCount() override;
+    void bind(Scalar* p, Scalar* g) override;
+    void initParams(mt19937& rng) override;
+    pair<size_t, size_t> size() override;
+    unique_ptr<Layer> clone() const override;
+
+    size_t bytes() const;                          // Memory held by the quantized weights
+
+    // Dot product kernel in use: "vnni", "avx2" or "portable", picked from the CPU on first use.
+    // useKernel switches it (for comparisons), false if the CPU can't run the one asked for
+    static const char* kernel();
+    static bool useKernel(const string& name);
+
+    ~QuantLayer() = default;
+};
+
+#endif
@@ -0,0 +1,90 @@
+#ifndef SHARDSTREAM_HPP
+#define SHARDSTREAM_HPP
+
+#include "layer.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace Eigen;
+
+// Training data read straight from disk, for datasets too large to keep in memory. Shards are pairs
+// of IDX files (unsigned byte samples and class labels) that are read front to back in large chunks.
+// Samples are randomized through a shuffle buffer of fixed capacity: every batch column is drawn
+// from a random slot, which is then refilled with the next sample on disk. Memory use depends on
+// the buffer and chunk sizes only, never on the size of the dataset.
+class ShardStream {
+
+public:
+
+    ShardStream(size_t classes, size_t buffer = 65536, size_t chunk = size_t(1) << 22);
+    ~ShardStream();
+
+    ShardStream(const ShardStream&) = delete;
+    ShardStream& operator=(const ShardStream&) = delete;
+
+    // Only reads the headers, throws runtime_error on a missing, malformed or mismatched shard
+    void add(const string& images, const string& labels);
+
+    size_t count() const;        // Samples in all shards
+    size_t sampleSize() const;   // Values per input
+    size_t classes() const;
+
+    // Starts an epoch: visits the shards in a new random order and fills the shuffle buffer. It and
+    // next throw runtime_error on a label that isn't below classes
+    void begin(mt19937& rng);
+
+    // Fills in and tg with the next bs samples, false once the epoch is over. Like
+    // NeuralNetwork::train the last batch wraps around to the first samples of the epoch, so every
+    // batch is bs wide
+    bool next(MatrixXs& in, MatrixXs& tg, size_t bs, mt19937& rng);
+
+private:
+
+    struct Shard {
+        string images, labels;
+        size_t items;
+        long image_start, label_start;   // First sample after the headers
+    };
+
+    // Sequential reader that fetches chunk bytes at a time (a plain descriptor on POSIX, so switching
+    // shards doesn't allocate)
+    struct Reader {
+#ifndef _WIN32
+        int fd = -1;
+#else
+        FILE* file = nullptr;
+#endif
+        vector<uint8_t> buf;
+        size_t pos = 0, len = 0;
+        void open(const string& path, long start);
+        void close();
+        void read(uint8_t* dst, size_t n);
+    };
+
+    vector<Shard> shards;
+    vector<size_t> order;
+    size_t n_classes, capacity, chunk;
+    size_t sample_size = 0;
+    size_t total = 0;
+
+    Reader images, labels;
+    size_t shard = 0;             // Position in order
+    size_t shard_left = 0;        // Samples of the current shard not read yet
+
+    vector<uint8_t> pixels;       // Shuffle buffer, capacity samples
+    vector<uint8_t> slot_labels;  // Label of every slot
+    size_t held = 0;
+
+    MatrixXs wrap_in, wrap_tg;    // First batch of the epoch (always full)
+    bool first_batch = false;
+
+    bool pull(size_t slot);       // Reads the next sample on disk into slot, false at the end of the epoch
+
+};
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef THREADPOOL_HPP
+#define THREADPOOL_HPP
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// Fixed set of worker threads that run one indexed job at a time. The calling
+// thread works too, so a pool of size n runs n tasks at once.
+class ThreadPool {
+
+public:
+
+    ThreadPool(size_t n);
+    ~ThreadPool();
+
+    // Runs job(0) ... job(tasks - 1) across the pool and returns once all of them finished.
+    // The job is passed by pointer rather than wrapped in a std::function, so this never allocates
+    template <typename Job>
+    void run(size_t tasks, const Job& job) {
+
+        runTasks(tasks, [](const void* j, size_t k) { (*static_cast<const Job*>(j))(k); }, &job);
+
+    }
+
+    size_t size() const;
+
+private:
+
+    vector<thread> workers;
+
+    mutex mtx;
+    condition_variable start_cv;
+    condition_variable done_cv;
+
+    void (*invoke)(const void*, size_t) = nullptr;
+    const void* job = nullptr;
+    size_t tasks = 0;
+    size_t next = 0;
+    size_t done = 0;
+    size_t generation = 0;
+    bool stopping = false;
+
+    void runTasks(size_t n, void (*inv)(const void*, size_t), const void* j);
+    void work(unique_lock<mutex>& lock);
+    void workerLoop();
+
+};
+
+#endif
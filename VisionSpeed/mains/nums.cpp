@@ -9,6 +9,7 @@
 #include <iostream>
 #include <deque>
 
+#include "datacache.hpp"
 #include "pseument.hpp"
 #include <SFML/Graphics.hpp>
 #include <SFML/Window.hpp>
@@ -30,40 +31,41 @@ bool training = false;
 bool fast = false;
 bool dSDisplay = false;
 bool printEpochs = true;
+bool augment = true;
 
-vector<vector<double>> images;
-vector<double> labels;
-int trainingSamples = 60000;
+DataCache mnist; // Packed MNIST, mapped straight from the cache file
+DataCache mnistTest; // Held-out t10k set, never trained on
 int trained = 0;
 
 int draw_radius = 4;
 const int largeGridSize = 140;
 const int smallGridSize = 28;
-const int ratio = largeGridSize / smallGridSize;
+const int gridRatio = largeGridSize / smallGridSize;
 const int cellSize = window_width / largeGridSize;
 const int dSCellSize = window_width / smallGridSize;
 vector<vector<double>> largeGrid(largeGridSize, vector<double>(largeGridSize, 0.0));
 vector<vector<double>> dSGrid(smallGridSize, vector<double>(smallGridSize, 0.0));
-vector<double> dSInput;
+vector<Scalar> dSInput;
+Workspace guessSpace; // Activations of the guess, kept apart from the training layers
 
 NeuralNetwork nn({
     MakeLayer("dense", "leakyrelu", {784}),
-    MakeLayer("convo", "sigmoid", {28, 28}, {28, 28}, 3),
+    MakeLayer("convo", "leakyrelu", {28, 28, 1}, {28, 28, 8}, 3),
+    MakeLayer("convo", "leakyrelu", {28, 28, 8}, {28, 28, 8}, 3),
     MakeLayer("dense", "leakyrelu", {30}),
     MakeLayer("dense", "leakyrelu", {10})
 });
 
-vector<double> inputs;
-vector<vector<double>> X;
-vector<vector<double>> Y;
+vector<Scalar> inputs;
+vector<vector<Scalar>> X;
+vector<vector<Scalar>> Y;
 size_t epochs = 5;
 size_t batchSize = 1;
-double trainingSpeed = 0.001;
+Scalar trainingSpeed = 0.001;
 
 void keyBoardInputs();
-vector<vector<double>> getMnistImages(const string& file_path, int num_images);
-vector<double> getMnistLabels(const string& file_path, int num_labels);
-int getNum(vector<double> outputs);
+int getNum(vector<Scalar> outputs);
+string saveName(const string& prefix);
 
 int main5(int argc, char* argv[]) {
     
@@ -71,7 +73,9 @@ int main5(int argc, char* argv[]) {
     if (argc > 1) {
         string filename = argv[1];
         cout << "Loading network: " << filename << "\n";
-        nn.load("../data/arc/" + filename + ".txt");
+        // Binary checkpoints first, older text saves still import
+        string path = "../data/arc/" + filename;
+        nn.load(ifstream(path + ".psm") ? path + ".psm" : path + ".txt");
     }
 
     sf::RenderWindow window(sf::VideoMode(window_width, window_height), "", sf::Style::None);
@@ -91,8 +95,18 @@ int main5(int argc, char* argv[]) {
     srand(time(0));
 
     // Get Mnist Data
-    images = getMnistImages("../data/imgs/mnist/train-images.idx3-ubyte", trainingSamples);
-    labels = getMnistLabels("../data/imgs/mnist/train-labels.idx1-ubyte", trainingSamples);
+    // Converted once, later launches only map the cache (a stale one is rebuilt)
+    mnist.openOrBuild("../data/imgs/mnist/train-images.idx3-ubyte", "../data/imgs/mnist/train-labels.idx1-ubyte", "../data/imgs/mnist/train.psd");
+    mnistTest.openOrBuild("../data/imgs/mnist/t10k-images.idx3-ubyte", "../data/imgs/mnist/t10k-labels.idx1-ubyte", "../data/imgs/mnist/t10k.psd");
+
+    // Test set accuracy on a weight snapshot every 25 epochs, evaluated next to training
+    nn.setMonitor(mnistTest.view(), mnistTest.oneHot(), 25);
+
+    // Background checkpoint with the whole training state, running it again with autosave resumes
+    nn.setCheckpoint("../data/arc/autosave.psm", 25);
+
+    // Shift, rotate, scale and bend the digits while training so they look more like drawn strokes
+    nn.setAugment(Augment());
 
     // cout << labels[0] << "\n";
     // for(int i = 0; i < 28; i++) {
@@ -102,13 +116,13 @@ int main5(int argc, char* argv[]) {
     //     cout << "\n";
     // }
 
+    dSInput = mnist.sample(mnist.items() - 3);
+
     for(int i = 0; i < 28; i++) {
         for(int j = 0; j < 28; j++) {
-            dSGrid[i][j] = images[images.size() - 3][i * 28 + j];
+            dSGrid[i][j] = dSInput[i * 28 + j];
         }
     }
-
-    dSInput = images[images.size() - 3];
     
     // Set up clock for frame timing
     sf::Clock clock;
@@ -126,7 +140,9 @@ int main5(int argc, char* argv[]) {
             keyBoardInputs();
 
             if(frameCount == 100 || training) {
-                guess = getNum(nn.forward(dSInput));
+                Index best;
+                nn.forwardBatch(Map<const VectorXs>(dSInput.data(), dSInput.size()), guessSpace).col(0).maxCoeff(&best);
+                guess = int(best);
                 // for(int i = 0; i < 28; i++) {
                 //     for(int j = 0; j < 28; j++) {
                 //         cout << round(dSInput[28 * i + j]);
@@ -142,26 +158,19 @@ int main5(int argc, char* argv[]) {
             while (window.pollEvent(event)) {
                 if (event.type == sf::Event::Closed) {
                     // Auto Save
-                    int id = rand() % 101;
-                    cout << "Saving network: " << "exit" + to_string(id) + "_" << to_string(int(epochs)) << ".txt" << "\n";
-                    nn.save("../data/arc/exit" + to_string(id) + "_" + to_string(int(epochs)) + ".txt");
+                    string name = saveName("exit");
+                    cout << "Saving network: " << name << "\n";
+                    nn.save("../data/arc/" + name);
                     window.close();
                 }
             }
 
             if(training) {
-                for(int i = 0; i < 1000; i++) {
-                    if((uint)(i + trained) >= images.size()) {
-                        trained = 0;
-                    }
-                    X.push_back(images[i + trained]);
-                    Y.push_back({0, 0, 0, 0, 0, 0, 0, 0, 0, 0});
-                    Y[Y.size() - 1][labels[i + trained]] = 1;
-                    trained++;
-                }
-                nn.train(X, Y, epochs, batchSize, trainingSpeed, "adamw", printEpochs);
-                X.clear();
-                Y.clear();
+                // The next 1000 images, gathered batch by batch straight from the mapped cache
+                if((size_t)trained + 1000 > mnist.items())
+                    trained = 0;
+                nn.train(mnist.view().slice(trained, 1000), mnist.oneHot().slice(trained, 1000), epochs, batchSize, trainingSpeed, "adamw", printEpochs);
+                trained += 1000;
             }
             else {
                 
@@ -204,14 +213,14 @@ int main5(int argc, char* argv[]) {
                     // Update downscaled grid
                     for (int i = 0; i < largeGridSize; ++i) {
                         for (int j = 0; j < largeGridSize; ++j) {
-                            dSGrid[i / ratio][j / ratio] += largeGrid[i][j];
+                            dSGrid[i / gridRatio][j / gridRatio] += largeGrid[i][j];
                         }
                     }
 
                     // Normalize the 5x5 block sum to [0,1] by dividing by 25
                     for (int i = 0; i < smallGridSize; ++i) {
                         for (int j = 0; j < smallGridSize; ++j) {
-                            dSGrid[i][j] /= ratio * ratio;
+                            dSGrid[i][j] /= gridRatio * gridRatio;
                         }
                     }
 
@@ -260,6 +269,31 @@ int main5(int argc, char* argv[]) {
 void keyBoardInputs() {
     
 
+    // Evaluate on the Test Set
+    if (sf::Keyboard::isKeyPressed(sf::Keyboard::V)) {
+        if(!V)
+            nn.evaluate(mnistTest.view(), mnistTest.oneHot()).print(true);
+        V = true;
+    }
+    else {
+        V = false;
+    }
+
+    // Toggle Training Augmentation
+    if (sf::Keyboard::isKeyPressed(sf::Keyboard::A)) {
+        if(!A) {
+            augment = !augment;
+            if(augment)
+                nn.setAugment(Augment());
+            else
+                nn.clearAugment();
+        }
+        A = true;
+    }
+    else {
+        A = false;
+    }
+
     // Toggle dSDisplay for Faster Training
     if (sf::Keyboard::isKeyPressed(sf::Keyboard::D)) {
         if(!D)
@@ -293,7 +327,7 @@ void keyBoardInputs() {
     // Print Network Information
     if (sf::Keyboard::isKeyPressed(sf::Keyboard::N)) {
         if(!N) {
-            cout << "\nName: " << "nw" << "_" << to_string(int(epochs)) << ".txt" << "\n";
+            cout << "\nName: " << "nw" << "_" << to_string(int(epochs)) << ".psm" << "\n";
             //vector<int> layers = nn.getLayers();
             //cout << "Layer Count: " << layers.size() << "\n";
             // cout << "Layers: ";
@@ -311,9 +345,10 @@ void keyBoardInputs() {
     // Save Network
     if (sf::Keyboard::isKeyPressed(sf::Keyboard::S)) {
         if(!S) {
-            int id = rand() % 101;
-            cout << "Saving network: " << "nw" << id << "_" << to_string(int(epochs)) << ".txt" << "\n";
-            nn.save("../data/arc/nw" + to_string(id) + "_" + to_string(int(epochs)) + ".txt");
+            // Written in the background, training and drawing carry on
+            string name = saveName("nw");
+            cout << "Saving network: " << name << "\n";
+            nn.saveAsync("../data/arc/" + name);
         }
         S = true;
     }
@@ -337,53 +372,8 @@ void keyBoardInputs() {
     }
 }
 
-vector<vector<double>> getMnistImages(const string& file_path, int num_images) {
-    const int image_size = 28 * 28; // Each image is 28x28 pixels
-    ifstream file(file_path, ios::binary);
-    if (!file.is_open())
-        throw runtime_error("Cannot open file: " + file_path);
-
-    // Read the header
-    file.ignore(16); // Skip the 16-byte header
-
-    // Prepare a container for the images
-    vector<vector<double>> images(num_images, vector<double>(image_size));
-
-    // Read each image
-    for (int i = 0; i < num_images; ++i) {
-        for (int j = 0; j < image_size; ++j) {
-            unsigned char pixel;
-            file.read(reinterpret_cast<char*>(&pixel), sizeof(pixel));
-            images[i][j] = pixel / 255.0f; // Normalize pixel values to [0, 1]
-        }
-    }
-    file.close();
-    return images;
-}
-
-vector<double> getMnistLabels(const string& file_path, int num_labels) {
-    ifstream file(file_path, ios::binary);
-    if (!file.is_open())
-        throw runtime_error("Cannot open file: " + file_path);
-
-    // Read the header
-    file.ignore(8); // Skip the 8-byte header
-
-    // Prepare a container for the labels
-    vector<double> labels(num_labels);
-
-    // Read each label
-    for (int i = 0; i < num_labels; ++i) {
-        unsigned char label;
-        file.read(reinterpret_cast<char*>(&label), sizeof(label));
-        labels[i] = label; // Store the label
-    }
-    file.close();
-    return labels;
-}
-
-int getNum(vector<double> outputs) {
-    double largestVal = outputs[0];
+int getNum(vector<Scalar> outputs) {
+    Scalar largestVal = outputs[0];
     int largestIndex = 0;
     for(int i = 1; i < 10; i++) {
         if(outputs[i] > largestVal) {
@@ -392,4 +382,12 @@ int getNum(vector<double> outputs) {
         }
     }
     return largestIndex;
-}
\ No newline at end of file
+}
+
+// Names saves after the time they were made and the epochs trained, so they never replace each other
+string saveName(const string& prefix) {
+    time_t now = time(nullptr);
+    char stamp[32];
+    strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", localtime(&now));
+    return prefix + "_" + stamp + "_" + to_string(nn.epochsTrained()) + ".psm";
+}
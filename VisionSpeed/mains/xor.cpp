@@ -32,12 +32,12 @@ NeuralNetwork nn({
     MakeLayer({2}, "dense", "leakyrelu"),
     MakeLayer({1}, "dense", "leakyrelu")
 });
-vector<double> inputs;
-vector<vector<double>> X;
-vector<vector<double>> Y;
+vector<Scalar> inputs;
+vector<vector<Scalar>> X;
+vector<vector<Scalar>> Y;
 size_t epochs = 1000;
 size_t batchSize = 1;
-double trainingSpeed = 0.01;
+Scalar trainingSpeed = 0.01;
 
 int main3() {
 
@@ -48,7 +48,7 @@ int main3() {
     nn.train(X, Y, epochs, batchSize, trainingSpeed, "adamw", true);
 
     for (uint i = 0; i < X.size(); i++) {
-        vector<double> prediction = nn.forward(X[i]);
+        vector<Scalar> prediction = nn.forward(X[i]);
         cout << "Prediction: " << (double)prediction[0] << " Ans: " << Y[i][0] << endl;
     }
 
@@ -0,0 +1,74 @@
+// Filename: alloccount.cpp
+// Description: Counts heap allocations so training steps can be checked for them
+
+#include "alloccount.hpp"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#ifdef PSEUMENT_COUNT_ALLOCS
+
+static std::atomic<size_t> allocs{0};
+static thread_local bool ignored = false;
+
+bool allocCountEnabled() { return true; }
+size_t allocCount() { return allocs.load(std::memory_order_relaxed); }
+void allocCountIgnoreThread() { ignored = true; }
+
+#ifdef __GLIBC__
+
+extern "C" {
+
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t n, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+
+void* malloc(size_t size) {
+    if (!ignored)
+        allocs.fetch_add(1, std::memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t n, size_t size) {
+    if (!ignored)
+        allocs.fetch_add(1, std::memory_order_relaxed);
+    return __libc_calloc(n, size);
+}
+
+void* realloc(void* ptr, size_t size) {
+    if (!ignored)
+        allocs.fetch_add(1, std::memory_order_relaxed);
+    return __libc_realloc(ptr, size);
+}
+
+}
+
+#else
+
+void* operator new(size_t size) {
+    if (!ignored)
+        allocs.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+void operator delete[](void* p, size_t) noexcept { std::free(p); }
+
+#endif
+
+#else
+
+bool allocCountEnabled() { return false; }
+size_t allocCount() { return 0; }
+void allocCountIgnoreThread() {}
+
+#endif
@@ -0,0 +1,85 @@
+// Filename: atomicfile.cpp
+// Description: Crash-safe whole file writes through a temporary file and rename
+
+#include "atomicfile.hpp"
+
+#include <cstdio>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <process.h>
+#endif
+
+bool writeFileAtomic(const string& path, const char* const* parts, const size_t* lengths, size_t count) {
+
+#ifndef _WIN32
+    string tmp = path + ".XXXXXX";
+    int fd = mkstemp(tmp.data());
+    if (fd < 0)
+        return false;
+    fchmod(fd, 0644);
+    bool ok = true;
+    for (size_t i = 0; i < count && ok; i++) {
+        size_t done = 0;
+        while (ok && done < lengths[i]) {
+            const ssize_t n = write(fd, parts[i] + done, lengths[i] - done);
+            ok = n > 0;
+            done += ok ? n : 0;
+        }
+    }
+    // The data has to be on disk before the rename makes it the file
+    ok = ok && fsync(fd) == 0;
+    close(fd);
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+        unlink(tmp.c_str());
+        return false;
+    }
+
+    // Flush the directory entry too, otherwise the rename itself can be lost in a crash
+    const size_t slash = path.rfind('/');
+    const string dir = slash == string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash);
+    int dfd = open(dir.c_str(), O_RDONLY);
+    if (dfd >= 0) {
+        fsync(dfd);
+        close(dfd);
+    }
+    return true;
+#else
+    // Process id and a per process counter keep the name apart from every other writer
+    static atomic<size_t> serial{0};
+    const string tmp = path + "." + to_string(_getpid()) + "." + to_string(serial++) + ".tmp";
+    {
+        ofstream file(tmp, ios::binary | ios::trunc);
+        if (!file)
+            return false;
+        for (size_t i = 0; i < count; i++)
+            file.write(parts[i], lengths[i]);
+        file.flush();
+        if (!file) {
+            file.close();
+            remove(tmp.c_str());
+            return false;
+        }
+    }
+    error_code ec;
+    filesystem::rename(tmp, path, ec);
+    if (ec)
+        remove(tmp.c_str());
+    return !ec;
+#endif
+
+}
+
+bool writeFileAtomic(const string& path, const vector<char>& data) {
+
+    const char* part = data.data();
+    const size_t length = data.size();
+    return writeFileAtomic(path, &part, &length, 1);
+
+}
@@ -0,0 +1,155 @@
+// Filename: augment.cpp
+// Description: Random shift, rotation, scale and elastic distortion of training images
+
+#include "augment.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+Augmenter::Augmenter(const Augment& c) : cfg(c) {
+
+    cfg.grid = max<size_t>(cfg.grid, 2);
+    cfg.threads = max<size_t>(cfg.threads, 1);
+
+    const Index rows = cfg.rows, cols = cfg.cols, px = rows * cols;
+    const Scalar cy = Scalar(rows - 1) / 2, cx = Scalar(cols - 1) / 2;
+    const Index g = cfg.grid;
+
+    // Everything that only depends on the pixel position is computed once
+    dr.resize(px);
+    dc.resize(px);
+    for (Index c = 0; c < cols; c++) {
+        for (Index r = 0; r < rows; r++) {
+            dr[r + c * rows] = r - cy;
+            dc[r + c * rows] = c - cx;
+        }
+    }
+
+    // Bilinear interpolation on the control grid is separable: every image row mixes the two
+    // control rows around it, every image column the two control columns
+    auto weights = [g](Index n) {
+        MatrixXs m = MatrixXs::Zero(n, g);
+        for (Index i = 0; i < n; i++) {
+            const Scalar t = n > 1 ? Scalar(i) * (g - 1) / (n - 1) : 0;
+            const Index k = min<Index>(Index(t), g - 2);
+            m(i, k) = 1 - (t - k);
+            m(i, k + 1) = t - k;
+        }
+        return m;
+    };
+    ry = weights(rows);
+    rc = weights(cols);
+
+    if (cfg.threads > 1)
+        pool.reset(new ThreadPool(cfg.threads));
+    scratch.resize(cfg.threads);
+    for (Scratch& s : scratch) {
+        s.sr.resize(px);
+        s.sc.resize(px);
+        s.half.resize(g, cols);
+        s.tap.resize(px);
+        s.padded.setZero((rows + 3) * (cols + 3));
+    }
+
+}
+
+size_t Augmenter::paramSize() const {
+
+    return 4 + 2 * cfg.grid * cfg.grid;
+
+}
+
+size_t Augmenter::imageSize() const {
+
+    return cfg.rows * cfg.cols * cfg.chans;
+
+}
+
+void Augmenter::prepare(size_t bs) {
+
+    params.resize(bs * paramSize());
+    warped.resize(imageSize(), bs);
+
+}
+
+void Augmenter::apply(MatrixXs& batch, mt19937& rng) {
+
+    const Index n = batch.cols();
+    const size_t ps = paramSize();
+    uniform_real_distribution<Scalar> unit(-1, 1);
+
+    // Draw every random number up front, in sample order
+    prepare(n);
+    for (Index b = 0; b < n; b++) {
+        Scalar* p = params.data() + b * ps;
+        const Scalar angle = cfg.rotate * unit(rng);
+        const Scalar zoom = 1 + cfg.scale * unit(rng);
+        p[0] = cos(angle) / zoom;
+        p[1] = sin(angle) / zoom;
+        p[2] = cfg.shift * unit(rng);
+        p[3] = cfg.shift * unit(rng);
+        for (size_t k = 4; k < ps; k++)
+            p[k] = cfg.elastic * unit(rng);
+    }
+
+    const Index px = cfg.rows * cfg.cols;
+    const size_t tasks = scratch.size();
+
+    // Each task warps a contiguous run of samples with its own scratch space
+    auto job = [&](size_t k) {
+        const Index first = n * k / tasks, last = n * (k + 1) / tasks;
+        for (Index b = first; b < last; b++)
+            for (Index ch = 0; ch < Index(cfg.chans); ch++)
+                warp(batch.col(b).data() + ch * px, warped.col(b).data() + ch * px, params.data() + b * ps, scratch[k]);
+    };
+    if (pool)
+        pool->run(tasks, job);
+    else
+        job(0);
+
+    // The warped batch takes the place of the original, whose storage becomes the next target
+    batch.swap(warped);
+
+}
+
+void Augmenter::warp(const Scalar* src, Scalar* dst, const Scalar* p, Scratch& s) const {
+
+    const Index rows = cfg.rows, cols = cfg.cols, px = rows * cols;
+    const Index g = cfg.grid, gg = g * g;
+    const Scalar cy = Scalar(rows - 1) / 2, cx = Scalar(cols - 1) / 2;
+
+    // Inverse mapping: every output pixel looks up where it comes from, rotated and scaled about
+    // the centre and shifted, for the whole image in one vectorized expression
+    s.sr = p[0] * dr - p[1] * dc + (cy - p[2]);
+    s.sc = p[1] * dr + p[0] * dc + (cx - p[3]);
+
+    // Elastic part: a displacement field interpolated from a coarse grid of random control points,
+    // as two small matrix products (control grid times column weights, then row weights times that)
+    if (cfg.elastic > 0) {
+        Map<MatrixXs> fy(s.sr.data(), rows, cols), fx(s.sc.data(), rows, cols);
+        s.half.noalias() = Map<const MatrixXs>(p + 4, g, g) * rc.transpose();
+        fy.noalias() += ry * s.half;
+        s.half.noalias() = Map<const MatrixXs>(p + 4 + gg, g, g) * rc.transpose();
+        fx.noalias() += ry * s.half;
+    }
+
+    // Bilinear resampling, pixels outside the source image count as background (zero). The source sits
+    // at (1, 1) of a border one pixel wide before and two after, and coordinates clamp to [-1, rows] x
+    // [-1, cols]: every tap then lands inside the padded image, and a clamped coordinate has no
+    // fraction, so it only reads the zero border
+    const Index pr = rows + 3;
+    Map<MatrixXs>(s.padded.data(), pr, cols + 3).block(1, 1, rows, cols) = Map<const MatrixXs>(src, rows, cols);
+    s.sr = s.sr.max(Scalar(-1)).min(Scalar(rows));
+    s.sc = s.sc.max(Scalar(-1)).min(Scalar(cols));
+    s.tap = (s.sr.floor().cast<Index>() + 1) + (s.sc.floor().cast<Index>() + 1) * pr;
+    s.sr -= s.sr.floor();
+    s.sc -= s.sc.floor();
+
+    // One pass combines the four taps of every pixel
+    const Scalar* pad = s.padded.data();
+    const Index* tap = s.tap.data();
+    auto taps = [&](Index off) { return ArrayXs::NullaryExpr(px, [pad, tap, off](Index i) { return pad[tap[i] + off]; }); };
+    Map<ArrayXs>(dst, px) = (1 - s.sr) * (1 - s.sc) * taps(0) + s.sr * (1 - s.sc) * taps(1)
+        + (1 - s.sr) * s.sc * taps(pr) + s.sr * s.sc * taps(pr + 1);
+
+}
@@ -0,0 +1,90 @@
+// Filename: batchloader.cpp
+// Description: Background mini-batch prefetching
+
+#include "batchloader.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <numeric>
+
+BatchLoader::BatchLoader(const DataView& X, const DataView& Y, size_t bs, size_t epochs, uint64_t seed, size_t first_epoch, 
+        size_t depth, Augmenter* aug) 
+        : X(X), Y(Y), bs(bs), epochs(epochs), seed(seed), first_epoch(first_epoch), aug(aug), slots(max<size_t>(depth, 2)), order(X.count), idx(bs) {
+
+    // Every slot is sized up front so the loader never allocates while training runs
+    for (Batch& slot : slots) {
+        slot.in.resize(X.size, bs);
+        slot.tg.resize(Y.size, bs);
+    }
+    if (aug)
+        aug->prepare(bs);
+
+    worker = thread(&BatchLoader::produce, this);
+
+}
+
+BatchLoader::~BatchLoader() {
+
+    stopping = true;
+    worker.join();
+
+}
+
+const BatchLoader::Batch& BatchLoader::next() {
+
+    const size_t t = tail.load(memory_order_relaxed);
+    while (head.load(memory_order_acquire) == t)
+        this_thread::yield();
+    return slots[t % slots.size()];
+
+}
+
+void BatchLoader::release() {
+
+    tail.store(tail.load(memory_order_relaxed) + 1, memory_order_release);
+
+}
+
+uint32_t BatchLoader::epochSeed(uint64_t seed, uint64_t epoch) {
+
+    // SplitMix64 finalizer, neighbouring epochs get unrelated seeds
+    uint64_t z = seed + (epoch + 1) * 0x9E3779B97F4A7C15ull;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return uint32_t(z ^ (z >> 31));
+
+}
+
+void BatchLoader::produce() {
+
+    const size_t n = X.count;
+
+    for (size_t epoch = 0; epoch < epochs; ++epoch) {
+
+        rng.seed(epochSeed(seed, first_epoch + epoch));
+        iota(order.begin(), order.end(), 0);
+        shuffle(order.begin(), order.end(), rng);
+
+        for (size_t i = 0; i < n; i += bs) {
+
+            // Wait for a free slot, the trainer is at most slots.size() batches behind
+            const size_t h = head.load(memory_order_relaxed);
+            while (h - tail.load(memory_order_acquire) == slots.size()) {
+                if (stopping)
+                    return;
+                this_thread::sleep_for(chrono::microseconds(20));
+            }
+
+            for (size_t b = 0; b < bs; ++b)
+                idx[b] = order[(i + b) % n];
+            Batch& slot = slots[h % slots.size()];
+            X.gather(idx.data(), bs, slot.in);
+            Y.gather(idx.data(), bs, slot.tg);
+            if (aug)
+                aug->apply(slot.in, rng);
+
+            head.store(h + 1, memory_order_release);
+        }
+    }
+
+}
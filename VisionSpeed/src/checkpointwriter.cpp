@@ -0,0 +1,76 @@
+// Filename: checkpointwriter.cpp
+// Description: Crash-safe checkpoint files written off the training thread
+
+#include "checkpointwriter.hpp"
+#include "atomicfile.hpp"
+
+#include <iostream>
+
+CheckpointWriter::CheckpointWriter() {
+
+    worker = thread(&CheckpointWriter::workerLoop, this);
+
+}
+
+CheckpointWriter::~CheckpointWriter() {
+
+    {
+        lock_guard<mutex> lock(mtx);
+        stopping = true;
+    }
+    cv.notify_all();
+    worker.join();
+
+}
+
+bool CheckpointWriter::busy() {
+
+    lock_guard<mutex> lock(mtx);
+    return pending;
+
+}
+
+vector<char>& CheckpointWriter::acquire() {
+
+    wait();
+    return buf;
+
+}
+
+void CheckpointWriter::submit(const string& p) {
+
+    {
+        lock_guard<mutex> lock(mtx);
+        path = p;
+        pending = true;
+    }
+    cv.notify_all();
+
+}
+
+void CheckpointWriter::wait() {
+
+    unique_lock<mutex> lock(mtx);
+    cv.wait(lock, [&] { return !pending; });
+
+}
+
+void CheckpointWriter::workerLoop() {
+
+    unique_lock<mutex> lock(mtx);
+    while (true) {
+        cv.wait(lock, [&] { return pending || stopping; });
+        if (!pending)
+            return;
+
+        // The buffer belongs to this thread until pending drops, acquire waits for that
+        lock.unlock();
+        if (!writeFileAtomic(path, buf))
+            cerr << "Failed writing checkpoint " << path << "\n";
+        lock.lock();
+
+        pending = false;
+        cv.notify_all();
+    }
+
+}
@@ -7,155 +7,235 @@
 
 ConvoLayer::ConvoLayer() {
 
-    w = MatrixXd::Random(0, 0);
-    b = MatrixXd::Zero(0, 0);
-    z = MatrixXd::Zero(0, 0);
-    a = MatrixXd::Zero(0, 0);
-
-    dz = MatrixXd::Zero(0, 0);
-    avg_grad_w = MatrixXd::Zero(0, 0);
-    avg_grad_b = MatrixXd::Zero(0, 0);
-
-    m_w = MatrixXd::Zero(0, 0);
-    v_w = MatrixXd::Zero(0, 0);
-    m_b = MatrixXd::Zero(0, 0);
-    v_b = MatrixXd::Zero(0, 0);
+    a = MatrixXs::Zero(0, 0);
+    dz = MatrixXs::Zero(0, 0);
 
 };
 
 ConvoLayer::ConvoLayer(vector<size_t> in_size, vector<size_t> out_size, string afn, size_t ks) : in_rows(in_size[0]), in_cols(in_size[1]), out_rows(out_size[0]), out_cols(out_size[1]), k_size(ks) {
 
-    w = MatrixXd::Random(k_size, k_size) * sqrt(2.0 / (k_size * k_size));
-    b = MatrixXd::Zero(out_rows, out_cols);
-    z = MatrixXd::Zero(out_rows * out_cols, 1);
-    a = MatrixXd::Zero(out_rows * out_cols, 1);
+    if (in_size.size() > 2)
+        in_chans = in_size[2];
+    if (out_size.size() > 2)
+        out_chans = out_size[2];
+
+    if (k_size % 2 == 0)
+        throw std::invalid_argument("Kernel must have an odd number of rows and columns");
 
-    dz = MatrixXd::Zero(out_rows * out_cols, 1);
-    avg_grad_w = MatrixXd::Zero(w.rows(), w.cols());
-    avg_grad_b = MatrixXd::Zero(b.rows(), b.cols());
+    // Same padding, the stride follows from how much the output shrinks (28 -> 14 is a stride of 2)
+    padding = k_size / 2;
+    stride = out_rows > 0 ? (in_rows + out_rows - 1) / out_rows : 0;
+    if (stride == 0 || (in_rows + 2 * padding - k_size) / stride + 1 != out_rows || (in_cols + 2 * padding - k_size) / stride + 1 != out_cols)
+        throw std::invalid_argument("Convolution output size doesn't match a whole number stride");
 
-    m_w = MatrixXd::Zero(w.rows(), w.cols());
-    v_w = MatrixXd::Zero(w.rows(), w.cols());
-    m_b = MatrixXd::Zero(b.rows(), b.cols());
-    v_b = MatrixXd::Zero(b.rows(), b.cols());
+    a = MatrixXs::Zero(out_rows * out_cols * out_chans, 1);
+    dz = MatrixXs::Zero(out_rows * out_cols * out_chans, 1);
+    b_px = VectorXs::Zero(out_rows * out_cols * out_chans);
 
     setActFunc(afn);
 
 };
 
-MatrixXd ConvoLayer::convolve(const MatrixXd& in, const size_t out_rows, const size_t out_cols, const MatrixXd& k) {
+void ConvoLayer::im2col(const MatrixXs& src, size_t rows, size_t cols, size_t chans, size_t o_rows, size_t o_cols, size_t s, MatrixXs& dst) const {
 
-    if(w.rows() % 2 == 0) std::cerr << "Kernel must have an odd number of rows and columns!" << std::endl;
-    if(w.rows() != w.cols()) std::cerr << "The kernel must be a square!" << std::endl;
+    im2col(src, rows, cols, chans, o_rows, o_cols, k_size, padding, s, dst);
 
-    const size_t padding = (k.rows()) / 2;
-    MatrixXd padded_input = MatrixXd::Zero(in.rows() + 2 * padding, in.cols() + 2 * padding);
-    padded_input.block(padding, padding, in.rows(), in.cols()) = in;
-
-    MatrixXd out = MatrixXd::Zero(out_rows, out_cols);
-    size_t stride = ((in.rows() * in.cols()) - (k.rows() * k.cols()) + 2 * padding) / ((out.rows() * out.cols()) - 1);
-    stride = 1;
+}
 
-    for (int r = 0; r < out.rows(); r++) { 
-        for (int c = 0; c < out.cols(); c++) {
-            out(r, c) = (padded_input.block(r * stride, c * stride, k.rows(), k.cols()).array() * k.array()).sum();
+void ConvoLayer::im2col(const MatrixXs& src, size_t rows, size_t cols, size_t chans, size_t o_rows, size_t o_cols, 
+        size_t ks, size_t pad, size_t s, MatrixXs& dst) {
+
+    const Index k = ks;
+    const Index px = rows * cols;
+    const Index o_px = o_rows * o_cols;
+    dst.resize(k * k * chans, o_px * src.cols());
+
+    // Patch row ch * k * k + j * k + i holds tap (i, j) of channel ch, matching the column
+    // order of a filter row in w. Taps that fall into the zero padding are written as zeros
+    for (Index n = 0; n < src.cols(); n++) {
+        for (Index c = 0; c < Index(o_cols); c++) {
+            for (Index r = 0; r < Index(o_rows); r++) {
+                Scalar* col = dst.col(n * o_px + c * o_rows + r).data();
+                const Index r0 = r * Index(s) - Index(pad);
+                const Index c0 = c * Index(s) - Index(pad);
+                for (Index ch = 0; ch < Index(chans); ch++) {
+                    Map<const MatrixXs> rect(src.col(n).data() + ch * px, rows, cols);
+                    for (Index j = 0; j < k; j++) {
+                        const Index ic = c0 + j;
+                        for (Index i = 0; i < k; i++) {
+                            const Index ir = r0 + i;
+                            *col++ = (ir >= 0 && ir < Index(rows) && ic >= 0 && ic < Index(cols)) ? rect(ir, ic) : Scalar(0);
+                        }
+                    }
+                }
+            }
         }
     }
 
-    return out;
+}
+
+void ConvoLayer::channelMajorDeltas() {
+
+    const Index out_px = out_rows * out_cols;
+
+    // dz_t(o, n * out_px + px) = dz(o * out_px + px, n), so one product covers the whole batch
+    dz_t.resize(out_chans, out_px * dz.cols());
+    for (Index n = 0; n < dz.cols(); n++)
+        dz_t.middleCols(n * out_px, out_px) = Map<const MatrixXs>(dz.col(n).data(), out_px, out_chans).transpose();
 
 }
 
-MatrixXd ConvoLayer::forward(const MatrixXd& in) {
+void ConvoLayer::col2im(MatrixXs& d_in) {
+
+    const Index k = k_size;
+    const Index in_px = in_rows * in_cols;
+    const Index out_px = out_rows * out_cols;
+    const Index batch = d_patches.cols() / out_px;
+    d_in.setZero(in_px * in_chans, batch);
+
+    // Inverse of im2col: every patch entry is added back onto the input pixel it was copied from
+    for (Index n = 0; n < batch; n++) {
+        for (Index c = 0; c < Index(out_cols); c++) {
+            for (Index r = 0; r < Index(out_rows); r++) {
+                const Scalar* col = d_patches.col(n * out_px + c * out_rows + r).data();
+                const Index r0 = r * Index(stride) - Index(padding);
+                const Index c0 = c * Index(stride) - Index(padding);
+                for (Index ch = 0; ch < Index(in_chans); ch++) {
+                    Map<MatrixXs> d_rect(d_in.col(n).data() + ch * in_px, in_rows, in_cols);
+                    for (Index j = 0; j < k; j++) {
+                        const Index ic = c0 + j;
+                        for (Index i = 0; i < k; i++) {
+                            const Index ir = r0 + i;
+                            if (ir >= 0 && ir < Index(in_rows) && ic >= 0 && ic < Index(in_cols))
+                                d_rect(ir, ic) += col[i];
+                        }
+                        col += k;
+                    }
+                }
+            }
+        }
+    }
+
+}
 
-    MatrixXd in_rect = Map<const Matrix<double, Dynamic, Dynamic>>(in.data(), in_rows, in_cols);
+const MatrixXs& ConvoLayer::forward(const MatrixXs& in) {
 
-    MatrixXd z_rect = convolve(in_rect, out_rows, out_cols, w) + b;
-   
-    z = Map<const Matrix<double, Dynamic, Dynamic>>(z_rect.data(), out_rows * out_cols, 1);
+    const Index out_px = out_rows * out_cols;
 
-    MatrixXd a_rect = a_func(z_rect);
-    a = Map<const Matrix<double, Dynamic, Dynamic>>(a_rect.data(), out_rows * out_cols, 1);
+    // One GEMM per sample writes all output channels straight into its column of a
+    im2col(in, in_rows, in_cols, in_chans, out_rows, out_cols, stride, patches);
+    a.resize(out_px * out_chans, in.cols());
+    for (Index n = 0; n < in.cols(); n++) {
+        Map<MatrixXs> a_n(a.col(n).data(), out_px, out_chans);
+        a_n.noalias() = patches.middleCols(n * out_px, out_px).transpose() * w.transpose();
+    }
+
+    // The channel bias is added together with the activation
+    Map<MatrixXs>(b_px.data(), out_px, out_chans).rowwise() = b.col(0).transpose();
+    biasActivate(a, b_px);
 
     return a;
 
 }
 
-void ConvoLayer::getOutputDeltas(const MatrixXd& target) {
+void ConvoLayer::infer(const MatrixXs& in, MatrixXs& out, MatrixXs& scratch) const {
 
-    MatrixXd error = a - target;
-    dz = error.array().cwiseProduct(a_func_deri(z).array());
-    
-}
+    const Index out_px = out_rows * out_cols;
 
-void ConvoLayer::backward(const MatrixXd& w_next, const MatrixXd& d_next) {
+    // forward with the patches in scratch, and the channel bias added per sample since b_px belongs to the layer
+    im2col(in, in_rows, in_cols, in_chans, out_rows, out_cols, stride, scratch);
+    out.resize(out_px * out_chans, in.cols());
+    for (Index n = 0; n < in.cols(); n++) {
+        Map<MatrixXs> out_n(out.col(n).data(), out_px, out_chans);
+        out_n.noalias() = scratch.middleCols(n * out_px, out_px).transpose() * w.transpose();
+        out_n.rowwise() += b.col(0).transpose();
+    }
+    activate(out, out.array());
+
+}
 
-    dz = (w_next.transpose() * d_next).array() * a_func_deri(z).array();
+void ConvoLayer::getOutputDeltas(const Ref<const MatrixXs>& target) {
 
+    dz = a - target;
+    applyActFuncDeri(dz);
+    
 }
 
-void ConvoLayer::updateGrads(const MatrixXd& in) {
+void ConvoLayer::inputGrad(MatrixXs& d_in) {
 
-    MatrixXd in_rect = Map<const Matrix<double, Dynamic, Dynamic>>(in.data(), in_rows, in_cols);
-    MatrixXd dz_rect = Map<const Matrix<double, Dynamic, Dynamic>>(dz.data(), out_rows, out_cols);
-    MatrixXd dz_rect_flipped = dz_rect.colwise().reverse().rowwise().reverse();
+    const Index k = k_size;
+    const Index kk = k * k;
+    const Index in_px = in_rows * in_cols;
 
-    size_t stride = 1;
+    if (stride == 1) {
 
-    // Perform the convolution to calculate the gradients
-    for (int r = 0; r <= in_rect.rows() - k_size; r += stride) {
-        for (int c = 0; c <= in_rect.cols() - k_size; c += stride) {
-            avg_grad_w += (in_rect.block(r, c, k_size, k_size).array() * dz_rect_flipped.block(r / stride, c / stride, k_size, k_size).array()).matrix();
+        // With stride one the input gradient is a full convolution of dz with the flipped kernel.
+        // Under same padding that is another same convolution, so it reuses im2col (a gather) and
+        // one GEMM per sample instead of scattering every patch back
+        w_flip.resize(in_chans, kk * out_chans);
+        for (Index o = 0; o < Index(out_chans); o++)
+            for (Index ci = 0; ci < Index(in_chans); ci++)
+                for (Index t = 0; t < kk; t++)
+                    w_flip(ci, o * kk + t) = w(o, ci * kk + kk - 1 - t);
+
+        im2col(dz, out_rows, out_cols, out_chans, in_rows, in_cols, 1, d_patches);
+        d_in.resize(in_px * in_chans, dz.cols());
+        for (Index n = 0; n < dz.cols(); n++) {
+            Map<MatrixXs> d_n(d_in.col(n).data(), in_px, in_chans);
+            d_n.noalias() = d_patches.middleCols(n * in_px, in_px).transpose() * w_flip.transpose();
         }
+        return;
     }
 
-    // Calculate the gradient for the bias
-    avg_grad_b += dz_rect;
+    // Strided layers skip input pixels, so every output delta is spread over its patch through the
+    // filters in one GEMM and then folded back onto the input
+    channelMajorDeltas();
+    d_patches.noalias() = w.transpose() * dz_t;
+    col2im(d_in);
 
 }
 
-void ConvoLayer::stepSGD(const double& lr, const size_t& bs) {
+void ConvoLayer::updateGrads(const MatrixXs& in) {
+
+    // patches still holds the im2col of in from forward
+    if (patches.cols() != Index(out_rows * out_cols) * in.cols())
+        im2col(in, in_rows, in_cols, in_chans, out_rows, out_cols, stride, patches);
 
-    // cout << "Dimensions " << w.rows() << " " << w.cols() << endl;
-    // cout << "Dimensions " << avg_grad_w.rows() << " " << avg_grad_w.cols() << endl;
-    // cout << "Dimensions " << b.rows() << " " << b.cols() << endl;
-    // cout << "Dimensions " << avg_grad_b.rows() << " " << avg_grad_b.cols() << endl;
+    // The weight gradient is a single correlation of the deltas with every patch of the batch
+    channelMajorDeltas();
+    avg_grad_w.noalias() += dz_t * patches.transpose();
+    avg_grad_b += dz_t.rowwise().sum();
+
+}
 
-    w -= (lr * avg_grad_w.array() / bs).matrix();
-    b -= (lr * avg_grad_b.array() / bs).matrix();
+size_t ConvoLayer::paramCount() {
 
-    avg_grad_w = MatrixXd::Zero(k_size, k_size);
-    avg_grad_b = MatrixXd::Zero(out_rows, out_cols);
+    return out_chans * k_size * k_size * in_chans + out_chans;
 
 }
 
-void ConvoLayer::stepAdamW(const double& lr, const size_t& bs, size_t& t) {
+void ConvoLayer::bind(Scalar* p, Scalar* g) {
 
-    MatrixXd grad_w = avg_grad_w / bs;
-    MatrixXd grad_b = avg_grad_b / bs;
+    bindParams(p, g, out_chans, k_size * k_size * in_chans, out_chans, 1);
 
-    m_w = (beta1 * m_w + (1 - beta1) * grad_w).matrix(); 
-    v_w = beta2 * v_w + (1 - beta2) * grad_w.array().square().matrix();
-    
-    m_b = (beta1 * m_b + (1 - beta1) * grad_b).matrix(); 
-    v_b = beta2 * v_b + (1 - beta2) * grad_b.array().square().matrix(); 
-    
-    MatrixXd m_hat_w = m_w / (1 - pow(beta1, t));
-    MatrixXd v_hat_w = v_w / (1 - pow(beta2, t));
+}
 
-    MatrixXd m_hat_b = m_b / (1 - pow(beta1, t));
-    MatrixXd v_hat_b = v_b / (1 - pow(beta2, t));
+void ConvoLayer::initParams(mt19937& rng) {
 
-    w -= (lr * (m_hat_w.array() / (v_hat_w.array().sqrt() + epsilon)).matrix() + lambda * w).matrix();
-    b -= (lr * (m_hat_b.array() / (v_hat_b.array().sqrt() + epsilon)).matrix() + lambda * b).matrix();
+    uniform_real_distribution<Scalar> u(-1, 1);
+    w = MatrixXs::NullaryExpr(out_chans, k_size * k_size * in_chans, [&]() { return u(rng); }) * sqrt(2.0 / (k_size * k_size * in_chans));
+    b.setZero();
 
-    avg_grad_w = MatrixXd::Zero(k_size, k_size);
-    avg_grad_b = MatrixXd::Zero(out_rows, out_cols);
-    
 }
 
 pair<size_t, size_t> ConvoLayer::size() {
 
     return {out_rows, out_cols};
 
+}
+
+unique_ptr<Layer> ConvoLayer::clone() const {
+
+    return unique_ptr<Layer>(new ConvoLayer(*this));
+
 }
\ No newline at end of file
@@ -0,0 +1,306 @@
+// Filename: datacache.cpp
+// Description: Packed, pre-normalized dataset cache files
+
+#include "datacache.hpp"
+#include "atomicfile.hpp"
+#include "idxfile.hpp"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Cache file (version 1, little-endian):
+//   PsdHeader | zero padding | samples at data_offset | labels at label_offset
+// Both sections start on a 64 byte boundary. The checksum covers everything from data_offset on
+static const char psd_magic[4] = {'P', 'S', 'M', 'D'};
+static const uint32_t psd_version = 1;
+
+struct PsdHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t encoding;       // 0 unsigned bytes, 1 float16
+    uint32_t classes;        // Width of the one-hot labels
+    uint64_t items;
+    uint64_t item_size;      // Values per sample
+    double scale;            // Stored value times scale is the network input
+    uint64_t data_offset;
+    uint64_t label_offset;
+    uint64_t source_stamp;   // Fingerprint of the IDX files the cache was built from
+    uint64_t checksum;       // FNV-1a of the samples and labels
+};
+
+static size_t alignUp(size_t n) {
+
+    return (n + 63) & ~size_t(63);
+
+}
+
+// FNV-1a, folding in eight bytes at a time so a whole dataset hashes in a few milliseconds
+static uint64_t fnv1a(const uint8_t* p, size_t n, uint64_t h = 14695981039346656037ull) {
+
+    const uint64_t prime = 1099511628211ull;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint64_t w;
+        memcpy(&w, p + i, 8);
+        h = (h ^ w) * prime;
+    }
+    for (; i < n; i++)
+        h = (h ^ p[i]) * prime;
+    return h;
+
+}
+
+// Sizes and modification times of the sources, any change to either file changes the stamp
+static uint64_t sourceStamp(const string& images, const string& labels) {
+
+    uint64_t h = 14695981039346656037ull;
+    for (const string& path : {images, labels}) {
+        error_code ec;
+        const uint64_t size = filesystem::file_size(path, ec);
+        const uint64_t time = ec ? 0 : uint64_t(filesystem::last_write_time(path, ec).time_since_epoch().count());
+        if (ec)
+            return 0;
+        h = fnv1a(reinterpret_cast<const uint8_t*>(&size), sizeof(size), h);
+        h = fnv1a(reinterpret_cast<const uint8_t*>(&time), sizeof(time), h);
+    }
+    return h;
+
+}
+
+DataCache::DataCache(const string& path) {
+
+    open(path);
+
+}
+
+DataCache::~DataCache() {
+
+    close();
+
+}
+
+void DataCache::open(const string& path) {
+
+    close();
+
+    size_t len = 0;
+
+#ifndef _WIN32
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw runtime_error("Cannot open file: " + path);
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (p != MAP_FAILED) {
+            mapped = p;
+            mapped_len = st.st_size;
+            bytes = static_cast<const uint8_t*>(p);
+            len = mapped_len;
+        }
+    }
+    ::close(fd);
+#else
+    ifstream file(path, ios::binary | ios::ate);
+    if (!file)
+        throw runtime_error("Cannot open file: " + path);
+    copy.resize(size_t(file.tellg()));
+    file.seekg(0);
+    file.read(reinterpret_cast<char*>(copy.data()), copy.size());
+    bytes = copy.data();
+    len = copy.size();
+#endif
+    if (!bytes)
+        throw runtime_error("Cannot map file: " + path);
+
+    PsdHeader h;
+    if (len < sizeof(h)) {
+        close();
+        throw runtime_error("Not a dataset cache: " + path);
+    }
+    memcpy(&h, bytes, sizeof(h));
+    if (memcmp(h.magic, psd_magic, 4) != 0 || h.version != psd_version || h.encoding > 1) {
+        close();
+        throw runtime_error("Not a dataset cache: " + path);
+    }
+
+    enc = Encoding(h.encoding);
+    const size_t value_bytes = enc == Encoding::u8 ? 1 : 2;
+    if (h.data_offset < sizeof(h) || h.label_offset < h.data_offset + h.items * h.item_size * value_bytes || len < h.label_offset + h.items) {
+        close();
+        throw runtime_error("Dataset cache is shorter than its header says: " + path);
+    }
+
+    n_items = h.items;
+    item_size = h.item_size;
+    n_classes = h.classes;
+    scale = h.scale;
+    stamp = h.source_stamp;
+    checksum = h.checksum;
+    payload_offset = h.data_offset;
+    data = bytes + h.data_offset;
+    labels = bytes + h.label_offset;
+
+}
+
+void DataCache::close() {
+
+#ifndef _WIN32
+    if (mapped)
+        munmap(mapped, mapped_len);
+#endif
+    mapped = nullptr;
+    mapped_len = 0;
+    copy.clear();
+    bytes = nullptr;
+    data = nullptr;
+    labels = nullptr;
+    n_items = item_size = n_classes = 0;
+
+}
+
+void DataCache::build(const string& images, const string& label_path, const string& path, size_t classes, Encoding enc) {
+
+    IdxFile img(images), lbl(label_path);
+    if (img.items() != lbl.items() || lbl.itemSize() != 1)
+        throw runtime_error("Labels don't match the images: " + label_path);
+    for (size_t i = 0; i < lbl.items(); i++)
+        if (*lbl.item(i) >= classes)
+            throw runtime_error("Label " + to_string(*lbl.item(i)) + " of sample " + to_string(i) + " is out of range for " + to_string(classes) + " classes: " + label_path);
+
+    const size_t n = img.items(), size = img.itemSize();
+    const size_t value_bytes = enc == Encoding::u8 ? 1 : 2;
+
+    PsdHeader h{};
+    memcpy(h.magic, psd_magic, 4);
+    h.version = psd_version;
+    h.encoding = uint32_t(enc);
+    h.classes = classes;
+    h.items = n;
+    h.item_size = size;
+    h.data_offset = alignUp(sizeof(h));
+    h.label_offset = alignUp(h.data_offset + n * size * value_bytes);
+    h.source_stamp = sourceStamp(images, label_path);
+
+    // Bytes keep the IDX values and carry the 1 / 255 as their scale, float16 stores the normalized
+    // values themselves
+    vector<uint8_t> body(h.label_offset - h.data_offset + n);
+    if (enc == Encoding::u8) {
+        h.scale = 1.0 / 255;
+        memcpy(body.data(), img.item(0), n * size);
+    } else {
+        h.scale = 1;
+        const Index count = n * size;
+        Map<Array<Eigen::half, Dynamic, 1>>(reinterpret_cast<Eigen::half*>(body.data()), count) = 
+            (Map<const Array<uint8_t, Dynamic, 1>>(img.item(0), count).cast<float>() * (1.0f / 255)).cast<Eigen::half>();
+    }
+    memcpy(body.data() + h.label_offset - h.data_offset, lbl.item(0), n);
+    h.checksum = fnv1a(body.data(), body.size());
+
+    // Written atomically, so a reader never maps a half written cache. Processes that find the same
+    // stale cache each write their own temporary copy, and whichever rename comes last wins
+    const char* parts[] = {reinterpret_cast<const char*>(&h), nullptr, reinterpret_cast<const char*>(body.data())};
+    const vector<char> pad(h.data_offset - sizeof(h), 0);
+    parts[1] = pad.data();
+    const size_t lengths[] = {sizeof(h), pad.size(), body.size()};
+    if (!writeFileAtomic(path, parts, lengths, 3))
+        throw runtime_error("Cannot write file: " + path);
+
+}
+
+void DataCache::openOrBuild(const string& images, const string& label_path, const string& path, size_t classes, Encoding e) {
+
+    // Only header checks here, so opening stays a plain mapping that touches no sample pages. The
+    // checksum covers the whole payload and is left to mkcache --verify and fresh builds
+    try {
+        open(path);
+        if (fresh(images, label_path) && n_classes == classes && enc == e)
+            return;
+        cout << "Dataset cache is out of date: " << path << "\n";
+    } catch (const runtime_error&) {
+        cout << "Building dataset cache: " << path << "\n";
+    }
+
+    close();
+    build(images, label_path, path, classes, e);
+    open(path);
+    if (!verify()) {
+        close();
+        throw runtime_error("Dataset cache doesn't match its checksum after building: " + path);
+    }
+
+}
+
+bool DataCache::fresh(const string& images, const string& label_path) const {
+
+    return bytes && stamp != 0 && stamp == sourceStamp(images, label_path);
+
+}
+
+bool DataCache::verify() const {
+
+    if (!bytes)
+        return false;
+    const size_t end = static_cast<size_t>(labels - bytes) + n_items;
+    return fnv1a(bytes + payload_offset, end - payload_offset) == checksum;
+
+}
+
+size_t DataCache::items() const {
+
+    return n_items;
+
+}
+
+size_t DataCache::itemSize() const {
+
+    return item_size;
+
+}
+
+size_t DataCache::classes() const {
+
+    return n_classes;
+
+}
+
+DataCache::Encoding DataCache::encoding() const {
+
+    return enc;
+
+}
+
+vector<Scalar> DataCache::sample(size_t i) const {
+
+    vector<Scalar> out(item_size);
+    const int idx = int(i);
+    MatrixXs col;
+    view().gather(&idx, 1, col);
+    copy_n(col.data(), item_size, out.begin());
+    return out;
+
+}
+
+DataView DataCache::view() const {
+
+    if (enc == Encoding::u8)
+        return DataView(static_cast<const uint8_t*>(data), n_items, item_size, 0, scale);
+    return DataView(static_cast<const Eigen::half*>(data), n_items, item_size, 0, scale);
+
+}
+
+DataView DataCache::oneHot() const {
+
+    return DataView::oneHot(labels, n_items, n_classes);
+
+}
@@ -0,0 +1,85 @@
+// Filename: dataview.cpp
+// Description: Zero-copy dataset views and mini-batch gathering
+
+#include "dataview.hpp"
+
+#include <cassert>
+#include <stdexcept>
+#include <string>
+
+DataView::DataView(const Scalar* d, size_t n, size_t sz, size_t st) : data(d), count(n), size(sz), stride(st ? st : sz), type(Type::scalar) {
+
+}
+
+DataView::DataView(const uint8_t* d, size_t n, size_t sz, size_t st, Scalar sc) : data(d), count(n), size(sz), stride(st ? st : sz), type(Type::u8), scale(sc) {
+
+}
+
+DataView::DataView(const Eigen::half* d, size_t n, size_t sz, size_t st, Scalar sc) : data(d), count(n), size(sz), stride(st ? st : sz), type(Type::f16), scale(sc) {
+
+}
+
+DataView::DataView(const MatrixXs& m) : data(m.data()), count(m.cols()), size(m.rows()), stride(m.rows()), type(Type::scalar) {
+
+}
+
+DataView DataView::oneHot(const uint8_t* d, size_t n, size_t classes, size_t st) {
+
+    // Checked once here, so gather never meets a label without a column
+    for (size_t i = 0; i < n; i++)
+        if (d[i * st] >= classes)
+            throw runtime_error("Label " + to_string(d[i * st]) + " of sample " + to_string(i) + " is out of range for " + to_string(classes) + " classes");
+
+    DataView view(d, n, classes, st);
+    view.stride = st;
+    view.type = Type::label;
+    return view;
+
+}
+
+DataView DataView::slice(size_t first, size_t n) const {
+
+    DataView view = *this;
+    const size_t bytes = type == Type::scalar ? sizeof(Scalar) : type == Type::f16 ? sizeof(Eigen::half) : 1;
+    view.data = static_cast<const char*>(data) + first * stride * bytes;
+    view.count = n;
+    return view;
+
+}
+
+void DataView::gather(const int* idx, size_t n, MatrixXs& out) const {
+
+    out.resize(size, n);
+
+    switch (type) {
+        case Type::scalar: {
+            const Scalar* base = static_cast<const Scalar*>(data);
+            for (size_t b = 0; b < n; b++)
+                out.col(b) = Map<const VectorXs>(base + idx[b] * stride, size);
+            break;
+        }
+        case Type::u8: {
+            const uint8_t* base = static_cast<const uint8_t*>(data);
+            for (size_t b = 0; b < n; b++)
+                out.col(b) = Map<const Matrix<uint8_t, Dynamic, 1>>(base + idx[b] * stride, size).cast<Scalar>() * scale;
+            break;
+        }
+        case Type::f16: {
+            const Eigen::half* base = static_cast<const Eigen::half*>(data);
+            for (size_t b = 0; b < n; b++)
+                out.col(b) = Map<const Matrix<Eigen::half, Dynamic, 1>>(base + idx[b] * stride, size).cast<Scalar>() * scale;
+            break;
+        }
+        case Type::label: {
+            const uint8_t* base = static_cast<const uint8_t*>(data);
+            out.setZero();
+            for (size_t b = 0; b < n; b++) {
+                const size_t label = base[idx[b] * stride];
+                assert(label < size);
+                out(label, b) = 1;
+            }
+            break;
+        }
+    }
+
+}
@@ -9,6 +9,7 @@
 #include <iostream>
 #include <deque>
 
+#include "idxfile.hpp"
 #include "pseument.hpp"
 #include <SFML/Graphics.hpp>
 #include <SFML/Window.hpp>
@@ -31,9 +32,8 @@ bool fast = false;
 bool dSDisplay = false;
 bool printEpochs = true;
 
-vector<vector<double>> images;
-vector<double> labels;
-int trainingSamples = 60000;
+IdxFile images; // Pixels stay as bytes in the mapped file
+IdxFile labels;
 int trained = 0;
 
 int draw_radius = 4;
@@ -45,25 +45,24 @@ const int dSCellSize = window_width / smallGridSize;
 vector<vector<double>> largeGrid(largeGridSize, vector<double>(largeGridSize, 0.0));
 vector<vector<double>> dSGrid(smallGridSize, vector<double>(smallGridSize, 0.0));
 vector<vector<double>> AIGrid(smallGridSize, vector<double>(smallGridSize, 1.0));
-vector<double> dSInput;
-vector<double> AIInput(smallGridSize * smallGridSize, 0);
+vector<Scalar> dSInput;
+vector<Scalar> AIInput(smallGridSize * smallGridSize, 0);
 
 NeuralNetwork nn({
     MakeLayer("dense", "leakyrelu", {784}),
     MakeLayer("convo", "sigmoid", {28, 28}, {28, 28}, 3)
 });
 
-vector<double> inputs;
-vector<vector<double>> X;
-vector<vector<double>> Y;
+vector<Scalar> inputs;
+vector<vector<Scalar>> X;
+vector<vector<Scalar>> Y;
 size_t epochs = 1;
 size_t batchSize = 1;
-double trainingSpeed = 0.001;
+Scalar trainingSpeed = 0.001;
 
 void keyBoardInputs();
-vector<vector<double>> getMnistImages(const string& file_path, int num_images);
-vector<double> getMnistLabels(const string& file_path, int num_labels);
-int getNum(vector<double> outputs);
+int getNum(vector<Scalar> outputs);
+string saveName(const string& prefix);
 
 int main(int argc, char* argv[]) {
     
@@ -71,7 +70,9 @@ int main(int argc, char* argv[]) {
     if (argc > 1) {
         string filename = argv[1];
         cout << "Loading network: " << filename << "\n";
-        nn.load("../data/arc/" + filename + ".txt");
+        // Binary checkpoints first, older text saves still import
+        string path = "../data/arc/" + filename;
+        nn.load(ifstream(path + ".psm") ? path + ".psm" : path + ".txt");
     }
 
     sf::RenderWindow window(sf::VideoMode(window_width, window_height), "", sf::Style::None);
@@ -87,17 +88,17 @@ int main(int argc, char* argv[]) {
     }
 
     // Get Mnist Data
-    images = getMnistImages("../data/imgs/mnist/train-images.idx3-ubyte", trainingSamples);
-    labels = getMnistLabels("../data/imgs/mnist/train-labels.idx1-ubyte", trainingSamples);
+    images.open("../data/imgs/mnist/train-images.idx3-ubyte");
+    labels.open("../data/imgs/mnist/train-labels.idx1-ubyte");
 
     for(int i = 0; i < 28; i++) {
         for(int j = 0; j < 28; j++) {
-            dSGrid[i][j] = images[images.size() - 4][i * 28 + j];
+            dSGrid[i][j] = images.item(images.items() - 4)[i * 28 + j] / Scalar(255);
         }
     }
 
-    dSInput = images[images.size() - 4];
-    AIInput = images[images.size() - 4];
+    dSInput = images.sample(images.items() - 4);
+    AIInput = images.sample(images.items() - 4);
 
     X.push_back(AIInput);
     Y.push_back(dSInput);
@@ -118,7 +119,7 @@ int main(int argc, char* argv[]) {
             keyBoardInputs();
 
             if(frameCount == 100 || training) {
-                vector<double> result = nn.forward(dSInput); 
+                vector<Scalar> result = nn.forward(dSInput); 
                 auto maxElementIter = std::max_element(result.begin(), result.end());
                 guess = std::distance(result.begin(), maxElementIter);
 
@@ -137,9 +138,9 @@ int main(int argc, char* argv[]) {
             while (window.pollEvent(event)) {
                 if (event.type == sf::Event::Closed) {
                     // Auto Save
-                    int id = rand() % 101;
-                    cout << "Saving network: " << "exit" + to_string(id) + "_" << to_string(int(epochs)) << ".txt" << "\n";
-                    nn.save("../data/arc/exit" + to_string(id) + "_" + to_string(int(epochs)) + ".txt");
+                    string name = saveName("exit");
+                    cout << "Saving network: " << name << "\n";
+                    nn.save("../data/arc/" + name);
                     window.close();
                 }
             }
@@ -158,10 +159,10 @@ int main(int argc, char* argv[]) {
 
             //if(training) {
             // for(int i = 0; i < 1000; i++) {
-            //     if((uint)(i + trained) >= images.size()) {
+            //     if((uint)(i + trained) >= images.items()) {
             //         trained = 0;
             //     }
-            //     Y[Y.size() - 1][labels[i + trained]] = 1;
+            //     Y[Y.size() - 1][labels.item(i + trained)[0]] = 1;
             //     trained++;
             // }
             nn.train(X, Y, epochs, batchSize, trainingSpeed, "adamw", printEpochs);
@@ -236,7 +237,7 @@ int main(int argc, char* argv[]) {
 
             // Render objects to screen
             if(!dSDisplay) {
-                vector<double> AIResult = nn.forward(AIInput);
+                vector<Scalar> AIResult = nn.forward(AIInput);
                 int AIGridSize = 28;
                 int AICellSize = window_width / AIGridSize;
                 sf::RectangleShape pixel(sf::Vector2f(AICellSize, AICellSize));
@@ -302,7 +303,7 @@ void keyBoardInputs() {
     // Print Network Information
     if (sf::Keyboard::isKeyPressed(sf::Keyboard::N)) {
         if(!N) {
-            cout << "\nName: " << "nw" << "_" << to_string(int(epochs)) << ".txt" << "\n";
+            cout << "\nName: " << "nw" << "_" << to_string(int(epochs)) << ".psm" << "\n";
             //vector<int> layers = nn.getLayerSizes();
             //cout << "Layer Count: " << layers.size() << "\n";
             // cout << "Layers: ";
@@ -320,9 +321,10 @@ void keyBoardInputs() {
     // Save Network
     if (sf::Keyboard::isKeyPressed(sf::Keyboard::S)) {
         if(!S) {
-            int id = rand() % 101;
-            cout << "Saving network: " << "nw" << id << "_" << to_string(int(epochs)) << ".txt" << "\n";
-            nn.save("../data/arc/nw" + to_string(id) + "_" + to_string(int(epochs)) + ".txt");
+            // Written in the background, training and drawing carry on
+            string name = saveName("nw");
+            cout << "Saving network: " << name << "\n";
+            nn.saveAsync("../data/arc/" + name);
         }
         S = true;
     }
@@ -346,53 +348,8 @@ void keyBoardInputs() {
     }
 }
 
-vector<vector<double>> getMnistImages(const string& file_path, int num_images) {
-    const int image_size = 28 * 28; // Each image is 28x28 pixels
-    ifstream file(file_path, ios::binary);
-    if (!file.is_open())
-        throw runtime_error("Cannot open file: " + file_path);
-
-    // Read the header
-    file.ignore(16); // Skip the 16-byte header
-
-    // Prepare a container for the images
-    vector<vector<double>> images(num_images, vector<double>(image_size));
-
-    // Read each image
-    for (int i = 0; i < num_images; ++i) {
-        for (int j = 0; j < image_size; ++j) {
-            unsigned char pixel;
-            file.read(reinterpret_cast<char*>(&pixel), sizeof(pixel));
-            images[i][j] = pixel / 255.0f; // Normalize pixel values to [0, 1]
-        }
-    }
-    file.close();
-    return images;
-}
-
-vector<double> getMnistLabels(const string& file_path, int num_labels) {
-    ifstream file(file_path, ios::binary);
-    if (!file.is_open())
-        throw runtime_error("Cannot open file: " + file_path);
-
-    // Read the header
-    file.ignore(8); // Skip the 8-byte header
-
-    // Prepare a container for the labels
-    vector<double> labels(num_labels);
-
-    // Read each label
-    for (int i = 0; i < num_labels; ++i) {
-        unsigned char label;
-        file.read(reinterpret_cast<char*>(&label), sizeof(label));
-        labels[i] = label; // Store the label
-    }
-    file.close();
-    return labels;
-}
-
-int getNum(vector<double> outputs) {
-    double largestVal = outputs[0];
+int getNum(vector<Scalar> outputs) {
+    Scalar largestVal = outputs[0];
     int largestIndex = 0;
     for(int i = 1; i < 10; i++) {
         if(outputs[i] > largestVal) {
@@ -401,4 +358,12 @@ int getNum(vector<double> outputs) {
         }
     }
     return largestIndex;
-}
\ No newline at end of file
+}
+
+// Names saves after the time they were made and the epochs trained, so they never replace each other
+string saveName(const string& prefix) {
+    time_t now = time(nullptr);
+    char stamp[32];
+    strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", localtime(&now));
+    return prefix + "_" + stamp + "_" + to_string(nn.epochsTrained()) + ".psm";
+}
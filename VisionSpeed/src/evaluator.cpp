@@ -0,0 +1,211 @@
+// Filename: evaluator.cpp
+// Description: Batched, threaded evaluation on held-out data
+
+#include "evaluator.hpp"
+#include "alloccount.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+
+void Evaluation::print(bool matrix) const {
+
+    cout << "Test";
+    if (epoch > 0)
+        cout << " (epoch " << epoch << ")";
+    cout << ": " << correct << " / " << samples << " (" << fixed << setprecision(2) << accuracy * 100 << "%)"
+         << " | loss " << setprecision(5) << loss << " | " << setprecision(0) << samples_per_sec << " samples/s\n";
+    cout.unsetf(ios::fixed);
+    cout << setprecision(6);
+
+    if (matrix) {
+        // Rows are the true classes, columns the network's guesses
+        for (Index r = 0; r < confusion.rows(); r++) {
+            cout << setw(3) << r << " |";
+            for (Index c = 0; c < confusion.cols(); c++)
+                cout << setw(6) << confusion(r, c);
+            cout << "\n";
+        }
+    }
+
+}
+
+Evaluator::Evaluator(size_t threads) : threads(max<size_t>(threads, 1)) {
+
+    if (this->threads > 1)
+        pool.reset(new ThreadPool(this->threads));
+
+}
+
+Evaluator::~Evaluator() {
+
+    if (background.joinable()) {
+        {
+            lock_guard<mutex> lock(mtx);
+            stopping = true;
+        }
+        cv.notify_all();
+        background.join();
+    }
+
+}
+
+Evaluation Evaluator::run(const vector<unique_ptr<Layer>>& layers, const DataView& X, const DataView& Y, size_t bs) {
+
+    Evaluation e;
+    const size_t n = min(X.count, Y.count);
+    const Index classes = max<Index>(Y.size, 2);
+    e.confusion.setZero(classes, classes);
+    if (n == 0 || bs == 0)
+        return e;
+
+    auto start = chrono::steady_clock::now();
+
+    // The layers are shared, every task only writes the activations in its own workspace
+    const size_t batches = (n + bs - 1) / bs;
+    const size_t tasks = min(threads, batches);
+    workers.resize(tasks);
+    for (Worker& w : workers) {
+        w.ws.acts.resize(layers.size());
+        w.ws.scratch.resize(layers.size());
+        w.idx.resize(bs);
+        w.correct = 0;
+        w.loss = 0;
+        w.confusion.setZero(classes, classes);
+    }
+
+    // Task k takes batches k, k + tasks, ... and only reads the weights
+    auto job = [&](size_t k) {
+
+        Worker& w = workers[k];
+        for (size_t batch = k; batch < batches; batch += tasks) {
+            const size_t first = batch * bs;
+            const size_t m = min(bs, n - first);
+            for (size_t b = 0; b < m; b++)
+                w.idx[b] = int(first + b);
+            X.gather(w.idx.data(), m, w.ws.acts[0]);
+            Y.gather(w.idx.data(), m, w.tg);
+
+            for (size_t l = 1; l < layers.size(); l++)
+                layers[l]->infer(w.ws.acts[l - 1], w.ws.acts[l], w.ws.scratch[l]);
+            const MatrixXs& out = w.ws.acts.back();
+
+            w.loss += 0.5 * double((out - w.tg).squaredNorm());
+            for (Index c = 0; c < out.cols(); c++) {
+                Index guess, ans;
+                if (out.rows() == 1) {
+                    guess = out(0, c) > 0.5;
+                    ans = w.tg(0, c) > 0.5;
+                } else {
+                    out.col(c).maxCoeff(&guess);
+                    w.tg.col(c).maxCoeff(&ans);
+                }
+                w.confusion(ans, guess)++;
+                if (guess == ans)
+                    w.correct++;
+            }
+        }
+
+    };
+    if (pool && tasks > 1)
+        pool->run(tasks, job);
+    else
+        for (size_t k = 0; k < tasks; k++)
+            job(k);
+
+    for (Worker& w : workers) {
+        e.correct += w.correct;
+        e.loss += w.loss;
+        e.confusion += w.confusion;
+    }
+    e.samples = n;
+    e.accuracy = double(e.correct) / n;
+    e.loss /= n;
+    e.samples_per_sec = n / chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return e;
+
+}
+
+bool Evaluator::start(const vector<unique_ptr<Layer>>& layers, const vector<size_t>& offsets, const Scalar* params, size_t count, 
+        const DataView& X, const DataView& Y, size_t bs, size_t epoch) {
+
+    unique_lock<mutex> lock(mtx);
+    if (running)
+        return false;
+
+    // The snapshot is the only thing taken from the caller, its weights can change right after this
+    snapshot = Map<const VectorXs>(params, count);
+    snapshot_layers.clear();
+    for (size_t l = 0; l < layers.size(); l++) {
+        snapshot_layers.push_back(layers[l]->clone());
+        if (l > 0)
+            snapshot_layers[l]->bind(snapshot.data() + offsets[l], nullptr);
+    }
+    bg_x = X;
+    bg_y = Y;
+    bg_bs = bs;
+    bg_epoch = epoch;
+    running = true;
+    finished = false;
+
+    if (!background.joinable())
+        background = thread(&Evaluator::backgroundLoop, this);
+    lock.unlock();
+    cv.notify_all();
+    return true;
+
+}
+
+size_t Evaluator::size() const {
+
+    return threads;
+
+}
+
+bool Evaluator::busy() {
+
+    lock_guard<mutex> lock(mtx);
+    return running;
+
+}
+
+bool Evaluator::ready() {
+
+    lock_guard<mutex> lock(mtx);
+    return finished;
+
+}
+
+Evaluation Evaluator::result() {
+
+    unique_lock<mutex> lock(mtx);
+    cv.wait(lock, [&] { return !running; });
+    finished = false;
+    return last;
+
+}
+
+void Evaluator::backgroundLoop() {
+
+    allocCountIgnoreThread();
+
+    unique_lock<mutex> lock(mtx);
+    while (true) {
+        cv.wait(lock, [&] { return running || stopping; });
+        if (stopping)
+            return;
+
+        // start doesn't touch the snapshot while running is set
+        lock.unlock();
+        Evaluation e = run(snapshot_layers, bg_x, bg_y, bg_bs);
+        e.epoch = bg_epoch;
+        lock.lock();
+
+        last = e;
+        running = false;
+        finished = true;
+        cv.notify_all();
+    }
+
+}
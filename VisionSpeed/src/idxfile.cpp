@@ -0,0 +1,167 @@
+// Filename: idxfile.cpp
+// Description: Memory mapped IDX dataset reader
+
+#include "idxfile.hpp"
+
+#include <fstream>
+#include <stdexcept>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+IdxFile::IdxFile(const string& path) {
+
+    open(path);
+
+}
+
+IdxFile::~IdxFile() {
+
+    close();
+
+}
+
+void IdxFile::open(const string& path) {
+
+    close();
+
+    const uint8_t* bytes = nullptr;
+    size_t len = 0;
+
+#ifndef _WIN32
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw runtime_error("Cannot open file: " + path);
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+            mapped = p;
+            mapped_len = st.st_size;
+            bytes = static_cast<const uint8_t*>(p);
+            len = mapped_len;
+        }
+    }
+    ::close(fd);
+#else
+    ifstream file(path, ios::binary | ios::ate);
+    if (!file)
+        throw runtime_error("Cannot open file: " + path);
+    copy.resize(size_t(file.tellg()));
+    file.seekg(0);
+    file.read(reinterpret_cast<char*>(copy.data()), copy.size());
+    bytes = copy.data();
+    len = copy.size();
+#endif
+    if (!bytes)
+        throw runtime_error("Cannot map file: " + path);
+
+    // Header: two zero bytes, the data type, the number of dimensions, then every dimension as a
+    // big-endian 32 bit integer
+    if (len < 4 || bytes[0] != 0 || bytes[1] != 0) {
+        close();
+        throw runtime_error("Not an IDX file: " + path);
+    }
+    if (bytes[2] != 0x08) {
+        close();
+        throw runtime_error("Only unsigned byte IDX data is supported: " + path);
+    }
+
+    const size_t n_dims = bytes[3];
+    const size_t header = 4 + 4 * n_dims;
+    if (n_dims == 0 || len < header) {
+        close();
+        throw runtime_error("Truncated IDX header: " + path);
+    }
+
+    item_size = 1;
+    for (size_t d = 0; d < n_dims; d++) {
+        const uint8_t* p = bytes + 4 + 4 * d;
+        dim.push_back(size_t(p[0]) << 24 | size_t(p[1]) << 16 | size_t(p[2]) << 8 | size_t(p[3]));
+        if (d > 0)
+            item_size *= dim[d];
+    }
+    if (item_size == 0) {
+        close();
+        throw runtime_error("Truncated IDX header: " + path);
+    }
+
+    if ((len - header) / item_size < dim[0]) {
+        close();
+        throw runtime_error("IDX file is shorter than its header says: " + path);
+    }
+
+    data = bytes + header;
+
+}
+
+void IdxFile::close() {
+
+#ifndef _WIN32
+    if (mapped)
+        munmap(mapped, mapped_len);
+#endif
+    mapped = nullptr;
+    mapped_len = 0;
+    copy.clear();
+    dim.clear();
+    item_size = 0;
+    data = nullptr;
+
+}
+
+size_t IdxFile::items() const {
+
+    return dim.empty() ? 0 : dim[0];
+
+}
+
+size_t IdxFile::itemSize() const {
+
+    return item_size;
+
+}
+
+const vector<size_t>& IdxFile::dims() const {
+
+    return dim;
+
+}
+
+const uint8_t* IdxFile::item(size_t i) const {
+
+    return data + i * item_size;
+
+}
+
+void IdxFile::normalize(size_t first, size_t count, Scalar* out) const {
+
+    // The items are contiguous, so the whole range converts as one vectorized expression
+    const Index n = count * item_size;
+    Map<Array<Scalar, Dynamic, 1>>(out, n) = Map<const Array<uint8_t, Dynamic, 1>>(item(first), n).cast<Scalar>() * Scalar(1.0 / 255);
+
+}
+
+vector<Scalar> IdxFile::sample(size_t i) const {
+
+    vector<Scalar> out(item_size);
+    normalize(i, 1, out.data());
+    return out;
+
+}
+
+DataView IdxFile::view() const {
+
+    return DataView(data, items(), item_size);
+
+}
+
+DataView IdxFile::oneHot(size_t classes) const {
+
+    return DataView::oneHot(data, items(), classes, item_size);
+
+}
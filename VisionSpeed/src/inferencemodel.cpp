@@ -0,0 +1,166 @@
+// Filename: inferencemodel.cpp
+// Description: Frozen, inference-only form of a trained network
+
+#include "inferencemodel.hpp"
+#include "pseument.hpp"
+
+#include <stdexcept>
+
+InferenceModel::InferenceModel(const NeuralNetwork& nn) {
+
+    pack(nn);
+
+}
+
+InferenceModel::InferenceModel(const string& fn) {
+
+    // The network only lives until its weights are packed
+    NeuralNetwork nn({MakeLayer("dense", "linear", {1})});
+    nn.load(fn);
+    if (nn.layers.size() < 2)
+        throw runtime_error("Couldn't load a network from " + fn);
+    pack(nn);
+
+}
+
+void InferenceModel::pack(const NeuralNetwork& nn) {
+
+    const size_t align = 64 / sizeof(Scalar);
+    const vector<unique_ptr<Layer>>& layers = nn.layers;
+
+    // Shapes first, so the weights can be copied into a buffer of the final size
+    in_size = layers[0]->a.rows();
+    Index count = 0;
+    auto reserve = [&](Index n) {
+        const Index at = count;
+        count += (n + align - 1) / align * align;
+        return at;
+    };
+    for (size_t l = 1; l < layers.size(); l++) {
+        Stage st = {};
+        st.act = layers[l]->a_func;
+        st.w_rows = layers[l]->w.rows();
+        st.w_cols = layers[l]->w.cols();
+        if (const DenseLayer* d = dynamic_cast<const DenseLayer*>(layers[l].get())) {
+            st.kind = Kind::dense;
+            st.in_rows = d->in_size;
+            st.out_rows = d->l_size;
+            st.in_cols = st.in_chans = st.out_cols = st.out_chans = 1;
+        } else if (const ConvoLayer* c = dynamic_cast<const ConvoLayer*>(layers[l].get())) {
+            st.kind = Kind::convo;
+            st.in_rows = c->in_rows;
+            st.in_cols = c->in_cols;
+            st.in_chans = c->in_chans;
+            st.out_rows = c->out_rows;
+            st.out_cols = c->out_cols;
+            st.out_chans = c->out_chans;
+            st.k_size = c->k_size;
+            st.stride = c->stride;
+            st.padding = c->padding;
+            // Filters are stored transposed, one per column, the layout the per-sample product reads
+            swap(st.w_rows, st.w_cols);
+        } else if (const PoolLayer* p = dynamic_cast<const PoolLayer*>(layers[l].get())) {
+            st.kind = Kind::pool;
+            st.max_pool = p->max_pool;
+            st.in_rows = p->in_rows;
+            st.in_cols = p->in_cols;
+            st.in_chans = st.out_chans = p->chans;
+            st.out_rows = p->out_rows;
+            st.out_cols = p->out_cols;
+            st.k_size = st.stride = p->p_size;
+        } else {
+            throw invalid_argument("Layer type can't be frozen");
+        }
+        st.w_at = reserve(st.w_rows * st.w_cols);
+        st.b_at = reserve(layers[l]->b.size());
+        stages.push_back(st);
+    }
+
+    weights = VectorXs::Zero(count);
+    for (size_t l = 1; l < layers.size(); l++) {
+        const Stage& st = stages[l - 1];
+        Map<MatrixXs> w(weights.data() + st.w_at, st.w_rows, st.w_cols);
+        if (st.kind == Kind::convo)
+            w = layers[l]->w.transpose();
+        else
+            w = layers[l]->w;
+        weights.segment(st.b_at, layers[l]->b.size()) = Map<const VectorXs>(layers[l]->b.data(), layers[l]->b.size());
+    }
+
+}
+
+const MatrixXs& InferenceModel::forwardBatch(const Ref<const MatrixXs>& in, Workspace& ws) const {
+
+    if (in.rows() != in_size)
+        throw invalid_argument("forwardBatch input has " + to_string(in.rows()) + " rows, the model takes " + to_string(in_size));
+
+    ws.acts.resize(stages.size() + 1);
+    ws.scratch.resize(stages.size() + 1);
+    ws.acts[0] = in;
+    for (size_t s = 0; s < stages.size(); s++) {
+        const Stage& st = stages[s];
+        switch (st.kind) {
+            case Kind::dense:
+                dense(st, ws.acts[s], ws.acts[s + 1]);
+                break;
+            case Kind::convo:
+                convo(st, ws.acts[s], ws.acts[s + 1], ws.scratch[s + 1]);
+                break;
+            case Kind::pool:
+                PoolLayer::pool(ws.acts[s], st.in_rows, st.in_cols, st.in_chans, st.out_rows, st.out_cols, st.k_size, st.max_pool, ws.acts[s + 1], nullptr);
+                break;
+        }
+    }
+
+    return ws.acts.back();
+
+}
+
+void InferenceModel::dense(const Stage& st, const MatrixXs& in, MatrixXs& out) const {
+
+    Map<const MatrixXs> w(weights.data() + st.w_at, st.w_rows, st.w_cols);
+    Map<const VectorXs> b(weights.data() + st.b_at, st.out_rows);
+
+    out.noalias() = w * in;
+    Layer::activate(st.act, out, (out.colwise() + b).array());
+
+}
+
+void InferenceModel::convo(const Stage& st, const MatrixXs& in, MatrixXs& out, MatrixXs& scratch) const {
+
+    const Index out_px = st.out_rows * st.out_cols;
+    Map<const MatrixXs> w_t(weights.data() + st.w_at, st.w_rows, st.w_cols);
+    Map<const Matrix<Scalar, 1, Dynamic>> b(weights.data() + st.b_at, st.out_chans);
+
+    // One product per sample writes its output channels, which then get the channel bias and the
+    // activation while they are still in cache
+    ConvoLayer::im2col(in, st.in_rows, st.in_cols, st.in_chans, st.out_rows, st.out_cols, st.k_size, st.padding, st.stride, scratch);
+    out.resize(out_px * st.out_chans, in.cols());
+    for (Index n = 0; n < in.cols(); n++) {
+        Map<MatrixXs> out_n(out.col(n).data(), out_px, st.out_chans);
+        out_n.noalias() = scratch.middleCols(n * out_px, out_px).transpose() * w_t;
+        Layer::activate(st.act, out_n, (out_n.rowwise() + b).array());
+    }
+
+}
+
+size_t InferenceModel::inputSize() const {
+
+    return in_size;
+
+}
+
+size_t InferenceModel::outputSize() const {
+
+    if (stages.empty())
+        return in_size;
+    const Stage& st = stages.back();
+    return st.out_rows * st.out_cols * st.out_chans;
+
+}
+
+size_t InferenceModel::bytes() const {
+
+    return sizeof(*this) + weights.size() * sizeof(Scalar) + stages.capacity() * sizeof(Stage);
+
+}
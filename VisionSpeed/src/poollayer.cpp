@@ -0,0 +1,155 @@
+// Filename: poollayer.cpp
+// Description: PoolLayer class implementation
+
+#include "poollayer.hpp"
+
+PoolLayer::PoolLayer() {
+
+    a = MatrixXs::Zero(0, 0);
+    dz = MatrixXs::Zero(0, 0);
+    setActFunc("linear");
+
+};
+
+PoolLayer::PoolLayer(vector<size_t> in_size, vector<size_t> out_size, string md) : in_rows(in_size[0]), in_cols(in_size[1]), out_rows(out_size[0]), out_cols(out_size[1]), mode(md) {
+
+    if (in_size.size() > 2)
+        chans = in_size[2];
+
+    if (mode != "max" && mode != "avg")
+        throw std::invalid_argument("Unknown pooling mode");
+    max_pool = mode == "max";
+    if (out_rows == 0 || out_cols == 0 || in_rows % out_rows != 0 || in_rows / out_rows != in_cols / out_cols || in_cols % out_cols != 0)
+        throw std::invalid_argument("Pooling needs the same whole number window along both axes");
+
+    p_size = in_rows / out_rows;
+
+    a = MatrixXs::Zero(out_rows * out_cols * chans, 1);
+    dz = MatrixXs::Zero(out_rows * out_cols * chans, 1);
+
+    // Pooling has no activation, deltas pass straight through
+    setActFunc("linear");
+
+};
+
+void PoolLayer::pool(const MatrixXs& in, MatrixXs& out, Matrix<Index, Dynamic, Dynamic>* picked) const {
+
+    pool(in, in_rows, in_cols, chans, out_rows, out_cols, p_size, max_pool, out, picked);
+
+}
+
+void PoolLayer::pool(const MatrixXs& in, size_t rows, size_t cols, size_t chans, size_t o_rows, size_t o_cols, 
+        size_t ps, bool max_pool, MatrixXs& out, Matrix<Index, Dynamic, Dynamic>* picked) {
+
+    const Index in_px = rows * cols;
+    const Index out_px = o_rows * o_cols;
+    const Index p = ps;
+    const Scalar area = Scalar(1) / (p * p);
+
+    out.resize(out_px * chans, in.cols());
+    if (picked && max_pool)
+        picked->resize(out.rows(), out.cols());
+
+    for (Index n = 0; n < in.cols(); n++) {
+        for (Index ch = 0; ch < Index(chans); ch++) {
+            Map<const MatrixXs> in_rect(in.col(n).data() + ch * in_px, rows, cols);
+            Map<MatrixXs> out_rect(out.col(n).data() + ch * out_px, o_rows, o_cols);
+            if (max_pool) {
+                for (Index c = 0; c < Index(o_cols); c++) {
+                    for (Index r = 0; r < Index(o_rows); r++) {
+                        Index wr, wc;
+                        out_rect(r, c) = in_rect.block(r * p, c * p, p, p).maxCoeff(&wr, &wc);
+                        if (picked)
+                            (*picked)(ch * out_px + c * o_rows + r, n) = ch * in_px + (c * p + wc) * rows + r * p + wr;
+                    }
+                }
+            } else {
+                for (Index c = 0; c < Index(o_cols); c++)
+                    for (Index r = 0; r < Index(o_rows); r++)
+                        out_rect(r, c) = in_rect.block(r * p, c * p, p, p).sum() * area;
+            }
+        }
+    }
+
+}
+
+const MatrixXs& PoolLayer::forward(const MatrixXs& in) {
+
+    pool(in, a, &argmax);
+    return a;
+
+}
+
+void PoolLayer::infer(const MatrixXs& in, MatrixXs& out, MatrixXs&) const {
+
+    pool(in, out, nullptr);
+
+}
+
+void PoolLayer::getOutputDeltas(const Ref<const MatrixXs>& target) {
+
+    dz = a - target;
+
+}
+
+void PoolLayer::inputGrad(MatrixXs& d_in) {
+
+    const Index in_px = in_rows * in_cols;
+    const Index out_px = out_rows * out_cols;
+    const Index p = p_size;
+    const Scalar area = Scalar(1) / (p * p);
+
+    d_in.setZero(in_px * chans, dz.cols());
+
+    // Max pooling routes each delta to the input that won, average pooling spreads it over the window
+    if (max_pool) {
+        for (Index n = 0; n < dz.cols(); n++)
+            for (Index i = 0; i < dz.rows(); i++)
+                d_in(argmax(i, n), n) += dz(i, n);
+        return;
+    }
+    for (Index n = 0; n < dz.cols(); n++) {
+        for (Index ch = 0; ch < Index(chans); ch++) {
+            Map<MatrixXs> d_rect(d_in.col(n).data() + ch * in_px, in_rows, in_cols);
+            Map<const MatrixXs> dz_rect(dz.col(n).data() + ch * out_px, out_rows, out_cols);
+            for (Index c = 0; c < Index(out_cols); c++)
+                for (Index r = 0; r < Index(out_rows); r++)
+                    d_rect.block(r * p, c * p, p, p).array() += dz_rect(r, c) * area;
+        }
+    }
+
+}
+
+void PoolLayer::updateGrads(const MatrixXs& in) {
+
+    (void)in;
+
+}
+
+size_t PoolLayer::paramCount() {
+
+    return 0;
+
+}
+
+void PoolLayer::bind(Scalar* p, Scalar* g) {
+
+    bindParams(p, g, 0, 0, 0, 0);
+
+}
+
+void PoolLayer::initParams(mt19937&) {
+
+}
+
+pair<size_t, size_t> PoolLayer::size() {
+
+    return {out_rows, out_cols};
+
+}
+
+unique_ptr<Layer> PoolLayer::clone() const {
+
+    return unique_ptr<Layer>(new PoolLayer(*this));
+
+}
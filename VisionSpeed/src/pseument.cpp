@@ -4,12 +4,20 @@
 // Description: Pseument (Pseudo Mantis), my first neural network
 
 #include "pseument.hpp"
+#include "atomicfile.hpp"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 NeuralNetwork::NeuralNetwork(const vector<MakeLayer>& l_info) {
     
     if(debugging) cout << "started constructor\n";
 
-    layers.push_back(unique_ptr<Layer>(new DenseLayer(l_info[0].l_size[0], l_info[0].l_size[0], l_info[0].a_func_name)));
+    layers.push_back(unique_ptr<Layer>(new DenseLayer(l_info[0].l_size[0], 0, l_info[0].a_func_name)));
     
     for (size_t l = 1; l < l_info.size(); ++l) {
         switch(l_info[l].l_type) {
@@ -19,28 +27,174 @@ NeuralNetwork::NeuralNetwork(const vector<MakeLayer>& l_info) {
             case 1:
                 layers.push_back(unique_ptr<ConvoLayer>(new ConvoLayer(l_info[l].l_size, l_info[l].o_size, l_info[l].a_func_name, l_info[l].k_size)));
                 break;
+            case 2:
+                layers.push_back(unique_ptr<PoolLayer>(new PoolLayer(l_info[l].l_size, l_info[l].o_size, l_info[l].a_func_name)));
+                break;
             default:
                 layers.push_back(unique_ptr<Layer>(new DenseLayer(l_info[l].l_size[0], layers[l - 1]->a.rows() * layers[l - 1]->a.cols(), l_info[l].a_func_name)));
                 break;
         }
     }
 
+    buildArena();
+    initParams();
+
     if(debugging) cout << "finished constructor\n";
 
 }
 
-vector<double> NeuralNetwork::forward(const vector<double>& input) {
+NeuralNetwork::~NeuralNetwork() {
+
+    // The writer finishes a pending checkpoint first
+    writer.reset();
+    monitor.reset();
+    unmap();
+
+}
+
+size_t NeuralNetwork::layoutArena() {
+
+    // Each layer starts on a 64 byte boundary (the arenas are 64 byte aligned, see EIGEN_MAX_ALIGN_BYTES),
+    // the padding between layers stays zero
+    const size_t align = 64 / sizeof(Scalar);
+
+    offsets.assign(layers.size(), 0);
+    size_t count = 0;
+    for (size_t l = 1; l < layers.size(); ++l) {
+        offsets[l] = count;
+        count += (layers[l]->paramCount() + align - 1) / align * align;
+    }
+    return count;
+
+}
+
+void NeuralNetwork::buildArena() {
+
+    size_t count = layoutArena();
+
+    unmap();
+    param_store = VectorXs::Zero(count);
+    new (&params) Map<VectorXs>(param_store.data(), count);
+
+    grads.resize(0);
+    prepareTraining();
+
+}
+
+void NeuralNetwork::bindLayers() {
+
+    for (size_t l = 1; l < layers.size(); ++l)
+        layers[l]->bind(params.data() + offsets[l], grads.size() ? grads.data() + offsets[l] : nullptr);
+
+    // Replicas point into the old arenas, they get rebuilt on the next threaded train call
+    replicas.clear();
+
+}
+
+void NeuralNetwork::prepareTraining() {
+
+    // Gradients and moments only exist once the network trains, so a loaded model stays read-mostly
+    if (grads.size() == params.size() && m.size() == params.size())
+        return;
+
+    grads = VectorXs::Zero(params.size());
+    m = VectorXs::Zero(params.size());
+    v = VectorXs::Zero(params.size());
+    bindLayers();
+
+}
+
+void NeuralNetwork::unmap() {
+
+#ifndef _WIN32
+    if (mapped)
+        munmap(mapped, mapped_len);
+#endif
+    mapped = nullptr;
+    mapped_len = 0;
+
+}
+
+void NeuralNetwork::buildReplicas() {
+
+    replicas.clear();
+    replicas.resize(threads);
+
+    for (size_t k = 0; k < threads; ++k) {
+        Replica& r = replicas[k];
+        if (k > 0)
+            r.grads = VectorXs::Zero(grads.size());
+        Scalar* g = k == 0 ? grads.data() : r.grads.data();
+
+        for (size_t l = 0; l < layers.size(); ++l) {
+            r.layers.push_back(layers[l]->clone());
+            if (l > 0)
+                r.layers[l]->bind(params.data() + offsets[l], g + offsets[l]);
+        }
+    }
+
+}
+
+void NeuralNetwork::setThreads(size_t n) {
+
+    threads = max<size_t>(n, 1);
+    pool.reset(threads > 1 ? new ThreadPool(threads) : nullptr);
+    replicas.clear();
+    if (threads > 1)
+        initParallel();
+
+}
+
+void NeuralNetwork::setPrefetch(bool on) {
+
+    prefetch = on;
+
+}
+
+void NeuralNetwork::setAugment(const Augment& cfg) {
+
+    // Only the inputs of train are distorted, forward and evaluation see the data as it is
+    augmenter.reset(new Augmenter(cfg));
+
+}
+
+void NeuralNetwork::clearAugment() {
+
+    augmenter.reset();
+
+}
+
+void NeuralNetwork::setSeed(unsigned s) {
+
+    seed = s;
+    if (params_fresh)
+        initParams();
+
+}
+
+void NeuralNetwork::initParams() {
+
+    // Drawn from the run seed, so the seed fixes the starting weights as well as every epoch
+    seed_seq seq{uint32_t(seed), uint32_t(seed >> 32)};
+    mt19937 gen(seq);
+    for (size_t l = 1; l < layers.size(); ++l)
+        layers[l]->initParams(gen);
+    params_fresh = true;
+
+}
+
+vector<Scalar> NeuralNetwork::forward(const vector<Scalar>& input) {
 
     if(debugging) cout << "Started forward\n";
     
-    // convert vector<double> to vectorxd
-    VectorXd in(input.size());
+    // convert vector<Scalar> to vectorxd
+    VectorXs in(input.size());
     for (size_t i = 0; i < input.size(); ++i)
         in[i] = input[i];
 
     forward(in);
 
-    vector<double> aws(layers.back()->a.data(), layers.back()->a.data() + layers.back()->a.size());
+    vector<Scalar> aws(layers.back()->a.data(), layers.back()->a.data() + layers.back()->a.size());
 
     if(debugging) cout << "Finished forward\n";
 
@@ -48,40 +202,91 @@ vector<double> NeuralNetwork::forward(const vector<double>& input) {
 
 }
 
-VectorXd NeuralNetwork::forward(const VectorXd& in) {
+const MatrixXs& NeuralNetwork::forward(const MatrixXs& in) {
+
+    forwardLayers(layers, in);
+    return layers.back()->a;
+
+}
+
+const MatrixXs& NeuralNetwork::forwardBatch(const Ref<const MatrixXs>& in, Workspace& ws) const {
+
+    if (in.rows() != layers[0]->a.rows())
+        throw invalid_argument("forwardBatch input has " + to_string(in.rows()) + " rows, the network takes " + to_string(layers[0]->a.rows()));
+
+    // Only ws is written, so any number of threads can run the same network with a workspace each.
+    // Its buffers keep their capacity, so repeated batches of the same size don't allocate
+    ws.acts.resize(layers.size());
+    ws.scratch.resize(layers.size());
+    ws.acts[0] = in;
+    for (size_t l = 1; l < layers.size(); ++l)
+        layers[l]->infer(ws.acts[l - 1], ws.acts[l], ws.scratch[l]);
+
+    return ws.acts.back();
+
+}
+
+InferenceModel NeuralNetwork::freeze() const {
+
+    return InferenceModel(*this);
+
+}
+
+void NeuralNetwork::getOutputDeltas(const MatrixXs& target) {
+
+    prepareTraining();
+    outputDeltas(layers, target, tested, correct);
+
+}
+
+void NeuralNetwork::backward() {
+
+    backwardLayers(layers);
+
+}
+
+void NeuralNetwork::forwardLayers(vector<unique_ptr<Layer>>& ls, const Ref<const MatrixXs>& in) {
 
     if(debugging) cout << "Started forward\n";
 
-    layers[0]->a = in;
-    MatrixXd out = in;
-    for (size_t l = 1; l < layers.size(); ++l) {
-        out = layers[l]->forward(out);
+    // Each column of in is one sample, so a whole batch goes through every layer at once
+    ls[0]->a = in;
+    for (size_t l = 1; l < ls.size(); ++l) {
+        ls[l]->forward(ls[l - 1]->a);
     }
 
     if(debugging) cout << "Finished forward " << "\n";
 
-    return out;
-
 }
 
-void NeuralNetwork::getOutputDeltas(const VectorXd& target) {
-    
+void NeuralNetwork::outputDeltas(vector<unique_ptr<Layer>>& ls, const Ref<const MatrixXs>& target, size_t& n_tested, size_t& n_correct) {
 
     if(debugging) cout << "Started getOutputDeltas\n";
 
-    layers.back()->getOutputDeltas(target);
+    ls.back()->getOutputDeltas(target);
 
     if(debugging) cout << "Start updating gradients\n";
 
-    layers.back()->updateGrads(layers[layers.size() - 2]->a);
+    ls.back()->updateGrads(ls[ls.size() - 2]->a);
 
     if(debugging) cout << "Finished updating gradients\n";
 
     if(debugging) cout << "Start accuracy testing\n";
 
-    tested++;
-    if(layers.back()->a(0) > 0.5 ? 1 : 0 == target(0))
-        correct++;
+    const MatrixXs& out = ls.back()->a;
+    for (Index c = 0; c < out.cols(); ++c) {
+        n_tested++;
+        if (out.rows() == 1) {
+            if ((out(0, c) > 0.5) == (target(0, c) > 0.5))
+                n_correct++;
+        } else {
+            Index guess, ans;
+            out.col(c).maxCoeff(&guess);
+            target.col(c).maxCoeff(&ans);
+            if (guess == ans)
+                n_correct++;
+        }
+    }
 
     if(debugging) cout << "Finished accuracy testing\n";
 
@@ -89,14 +294,14 @@ void NeuralNetwork::getOutputDeltas(const VectorXd& target) {
     
 }
 
-void NeuralNetwork::backward() {
+void NeuralNetwork::backwardLayers(vector<unique_ptr<Layer>>& ls) {
 
     if(debugging) cout << "Started backward\n";
 
-    for (size_t l = layers.size() - 2; l > 0; --l) {
+    for (size_t l = ls.size() - 2; l > 0; --l) {
 
-        layers[l]->backward(layers[l + 1]->w, layers[l + 1]->dz);
-        layers[l]->updateGrads(layers[l - 1]->a);
+        ls[l]->backward(*ls[l + 1]);
+        ls[l]->updateGrads(ls[l - 1]->a);
 
     }
 
@@ -104,106 +309,704 @@ void NeuralNetwork::backward() {
 
 }
 
-void NeuralNetwork::stepSGD(double& lr, size_t& bs) {
+void NeuralNetwork::parallelStep(const MatrixXs& batch_in, const MatrixXs& batch_tg) {
+
+    if(debugging) cout << "Started parallelStep\n";
+
+    // Each replica takes a contiguous slice of the batch, the first bs % n slices get one extra sample
+    const size_t bs = batch_in.cols();
+    const size_t n = min(replicas.size(), bs);
+
+    pool->run(n, [&](size_t k) {
+        const size_t start = k * (bs / n) + min(k, bs % n);
+        const size_t count = bs / n + (k < bs % n ? 1 : 0);
+        Replica& r = replicas[k];
+        forwardLayers(r.layers, batch_in.middleCols(start, count));
+        outputDeltas(r.layers, batch_tg.middleCols(start, count), r.tested, r.correct);
+        backwardLayers(r.layers);
+    });
+
+    // Pairwise tree reduction into replica 0 (which accumulates into grads). The pairing only
+    // depends on the thread count, so runs with the same seed and thread count match exactly
+    for (size_t stride = 1; stride < n; stride *= 2) {
+        pool->run((n + 2 * stride - 1) / (2 * stride), [&](size_t k) {
+            const size_t dst = 2 * stride * k;
+            if (dst + stride >= n)
+                return;
+            Scalar* to = dst == 0 ? grads.data() : replicas[dst].grads.data();
+            Map<VectorXs>(to, grads.size()) += replicas[dst + stride].grads;
+            replicas[dst + stride].grads.setZero();
+        });
+    }
+
+    for (size_t k = 0; k < n; ++k) {
+        tested += replicas[k].tested;
+        correct += replicas[k].correct;
+        replicas[k].tested = 0;
+        replicas[k].correct = 0;
+    }
+
+    if(debugging) cout << "Finished parallelStep\n";
+
+}
+
+void NeuralNetwork::stepSGD(Scalar& lr, size_t& bs) {
 
     if(debugging) cout << "Started updateNeurons\n";
     
-    for (size_t l = 1; l < layers.size(); ++l)
-        layers[l]->stepSGD(lr, bs);
+    params -= (lr / bs) * grads;
+    grads.setZero();
 
      if(debugging) cout << "Finished updateNeurons\n";
 
 }
 
-void NeuralNetwork::stepAdamW(double& lr, size_t& bs, size_t& t) {
+void NeuralNetwork::stepAdamW(Scalar& lr, size_t& bs, size_t& t) {
 
     if(debugging) cout << "Started updateNeurons\n";
-    
-    for (size_t l = 1; l < layers.size(); ++l)
-        layers[l]->stepAdamW(lr, bs, t);
+
+    // Batch averaging and bias correction are folded into scalars so the update needs no temporaries
+    const Scalar g_scale = Scalar(1) / bs;
+    const Scalar m_corr = Scalar(1) / (1 - pow(beta1, t));
+    const Scalar v_corr = Scalar(1) / (1 - pow(beta2, t));
+
+    // One sweep over the arena in cache sized chunks, so each chunk of m, v, params and grads
+    // is loaded once for all four updates
+    const Index chunk = 2048;
+    auto sweep = [&](size_t c) {
+
+        const Index i = Index(c) * chunk;
+        const Index n = min(chunk, params.size() - i);
+        auto p_c = params.segment(i, n);
+        auto g_c = grads.segment(i, n);
+        auto m_c = m.segment(i, n);
+        auto v_c = v.segment(i, n);
+
+        m_c = beta1 * m_c + ((1 - beta1) * g_scale) * g_c;
+        v_c = beta2 * v_c + ((1 - beta2) * g_scale * g_scale) * g_c.cwiseAbs2();
+        p_c -= lr * (m_corr * m_c.array() / ((v_corr * v_c.array()).sqrt() + epsilon)).matrix() + lambda * p_c;
+        g_c.setZero();
+
+    };
+
+    // Chunks are independent, so the sweep is split across the pool when training is threaded
+    const size_t chunks = (params.size() + chunk - 1) / chunk;
+    if (pool)
+        pool->run(chunks, sweep);
+    else
+        for (size_t c = 0; c < chunks; ++c)
+            sweep(c);
     
      if(debugging) cout << "Finished updateNeurons\n";
 
 }
 
 
-void NeuralNetwork::train(vector<vector<double>>& X, vector<vector<double>>& Y, 
-        size_t& epochs, size_t& bs, double& lr, string da, bool print) {
+void NeuralNetwork::train(vector<vector<Scalar>>& X, vector<vector<Scalar>>& Y, 
+        size_t& epochs, size_t& bs, Scalar& lr, string da, bool print) {
 
-    if(debugging) cout << "Started train\n";
+    // Nested vectors aren't contiguous, so they are packed once into buffers kept between calls
+    pack_x.resize(X[0].size(), X.size());
+    pack_y.resize(Y[0].size(), Y.size());
+    for (size_t i = 0; i < X.size(); ++i) {
+        pack_x.col(i) = Map<const VectorXs>(X[i].data(), X[i].size());
+        pack_y.col(i) = Map<const VectorXs>(Y[i].data(), Y[i].size());
+    }
 
-    if(da == "sgd")
-        descent = 0;
-    else if(da == "adamw")
-        descent = 1;
-    else
-        descent = 0;
+    train(DataView(pack_x), DataView(pack_y), epochs, bs, lr, da, print);
+
+}
+
+void NeuralNetwork::train(const DataView& X, const DataView& Y, 
+        size_t& epochs, size_t& bs, Scalar& lr, string da, bool print) {
 
-    for(size_t l = 1; l < layers.size(); ++l) {
-        layers[l]->lambda = lr / 100; // Weight decay
+    if(debugging) cout << "Started train\n";
+
+    if (X.count == 0 || X.count != Y.count) {
+        cerr << "Training data needs the same, non-zero number of inputs and targets\n";
+        return;
+    }
+    if (augmenter && augmenter->imageSize() != X.size) {
+        cerr << "Augmentation image shape doesn't match the training inputs\n";
+        return;
     }
 
-    size_t numSamples = X.size();
-    
-    // Convert inputs to MatrixXd
-    MatrixXd inputs(numSamples, X[0].size());
-    for (size_t i = 0; i < numSamples; ++i) {
-        for (size_t j = 0; j < X[i].size(); ++j) {
-            inputs(i, j) = X[i][j];
+    beginTraining(lr, da);
+
+    size_t numSamples = X.count;
+
+    vector<int> shuffled(numSamples);
+    batch_idx.resize(bs);
+
+    // With prefetching the loader thread shuffles and gathers batch N + 1 while batch N trains,
+    // a single batch run isn't worth the thread
+    unique_ptr<BatchLoader> loader;
+    if (prefetch && numSamples * epochs > bs)
+        loader.reset(new BatchLoader(X, Y, bs, epochs, seed, trained, 2, augmenter.get()));
+    else if (augmenter)
+        augmenter->prepare(bs);
+
+    for (size_t epoch = 0; epoch < epochs; ++epoch) {
+
+        if (!loader) {
+            rng.seed(BatchLoader::epochSeed(seed, trained));
+            iota(shuffled.begin(), shuffled.end(), 0);
+            shuffle(shuffled.begin(), shuffled.end(), rng);
         }
-    }
+        t++;
+        correct = 0;
+        tested = 0;
+
+        size_t steps = 0;
+        size_t step_allocs = 0;
+
+        for (size_t i = 0; i < numSamples; i += bs) {
+
+            size_t allocs_before = allocCount();
+
+            const MatrixXs* in = &batch_in;
+            const MatrixXs* tg = &batch_tg;
+            if (loader) {
+                const BatchLoader::Batch& batch = loader->next();
+                in = &batch.in;
+                tg = &batch.tg;
+            } else {
+                // The last batch wraps around to the start so every step sees a full batch. Samples are
+                // gathered straight from the views into the reused batch buffers (one column each)
+                for (size_t b = 0; b < bs; ++b)
+                    batch_idx[b] = shuffled[(i + b) % numSamples];
+                X.gather(batch_idx.data(), bs, batch_in);
+                Y.gather(batch_idx.data(), bs, batch_tg);
+                if (augmenter)
+                    augmenter->apply(batch_in, rng);
+            }
+
+            backpropBatch(*in, *tg);
+
+            // The batch is fully consumed by backward, so its slot can be refilled during the update
+            if (loader)
+                loader->release();
+
+            updateParams(lr, bs);
 
-    // Convert targets to MatrixXd14
-    MatrixXd targets(numSamples, Y[0].size());
-    for (size_t i = 0; i < numSamples; ++i) {
-        for (size_t j = 0; j < Y[i].size(); ++j) {
-            targets(i, j) = Y[i][j];
+            // The first step of a run sizes every buffer, so only later steps are counted
+            if (epoch > 0 || i > 0) {
+                steps++;
+                step_allocs += allocCount() - allocs_before;
+            }
         }
+
+        if (print)
+            printEpoch(epoch, steps, step_allocs);
+        finishEpoch(print);
+    }
+
+    if(debugging) cout << "Finished train\n";
+
+}
+
+void NeuralNetwork::train(ShardStream& S, size_t& epochs, size_t& bs, Scalar& lr, string da, bool print) {
+
+    if(debugging) cout << "Started train\n";
+
+    if (S.count() == 0) {
+        cerr << "Training stream has no samples\n";
+        return;
+    }
+    if (augmenter && augmenter->imageSize() != S.sampleSize()) {
+        cerr << "Augmentation image shape doesn't match the training inputs\n";
+        return;
     }
 
-    vector<int> shuffled(inputs.rows());
-    iota(shuffled.begin(), shuffled.end(), 0);
-    random_device rd;
-    mt19937 g(rd());
+    beginTraining(lr, da);
+    if (augmenter)
+        augmenter->prepare(bs);
 
+    // Same epochs as the in-memory overload, only the batches come from the shuffle buffer of the stream
     for (size_t epoch = 0; epoch < epochs; ++epoch) {
 
-        shuffle(shuffled.begin(), shuffled.end(), g);
+        rng.seed(BatchLoader::epochSeed(seed, trained));
+        S.begin(rng);
         t++;
         correct = 0;
         tested = 0;
 
-        for (size_t i = 0; i < size_t(inputs.rows()); i += bs) {
+        size_t steps = 0;
+        size_t step_allocs = 0;
 
-            for (size_t b = 0; b < bs; ++b) {
+        for (size_t i = 0; ; i++) {
 
-                forward(inputs.row(shuffled[i + b]));
-                getOutputDeltas(targets.row(shuffled[i + b]));
-                backward();
+            size_t allocs_before = allocCount();
 
-            }
-            switch(descent) {
-                case 0:
-                    stepSGD(lr, bs);
-                    break;
-                case 1:
-                    stepAdamW(lr, bs, t);
-                    break;
+            if (!S.next(batch_in, batch_tg, bs, rng))
+                break;
+            if (augmenter)
+                augmenter->apply(batch_in, rng);
+
+            backpropBatch(batch_in, batch_tg);
+            updateParams(lr, bs);
+
+            if (epoch > 0 || i > 0) {
+                steps++;
+                step_allocs += allocCount() - allocs_before;
             }
         }
 
-        if (print) cout << "Epoch " << epoch + 1 << ": " << correct << " / " << tested << "\n";
+        if (print)
+            printEpoch(epoch, steps, step_allocs);
+        finishEpoch(print);
     }
 
     if(debugging) cout << "Finished train\n";
 
 }
 
+void NeuralNetwork::beginTraining(Scalar& lr, const string& da) {
+
+    params_fresh = false;
+    prepareTraining();
+
+    if(da == "sgd")
+        descent = 0;
+    else if(da == "adamw")
+        descent = 1;
+    else
+        descent = 0;
+
+    lambda = lr / 100; // Weight decay
+
+    if (threads > 1 && replicas.empty())
+        buildReplicas();
+
+}
+
+void NeuralNetwork::backpropBatch(const MatrixXs& in, const MatrixXs& tg) {
+
+    if (threads > 1) {
+        parallelStep(in, tg);
+    } else {
+        forward(in);
+        getOutputDeltas(tg);
+        backward();
+    }
+
+}
+
+void NeuralNetwork::updateParams(Scalar& lr, size_t& bs) {
+
+    switch(descent) {
+        case 0:
+            stepSGD(lr, bs);
+            break;
+        case 1:
+            stepAdamW(lr, bs, t);
+            break;
+    }
+
+}
+
+void NeuralNetwork::finishEpoch(bool print) {
+
+    trained++;
+
+    // The monitor evaluates a snapshot of the weights while the next epochs train, its result is
+    // printed at the first epoch end after it finished
+    if (monitor_every > 0) {
+        if (print && evaluationReady())
+            lastEvaluation().print();
+        if (trained % monitor_every == 0)
+            evaluateAsync(monitor_x, monitor_y);
+    }
+
+    // The snapshot is a copy of the arenas, the writer thread does the slow part. When the previous
+    // checkpoint is still being written the next one waits an epoch instead of stalling training
+    if (checkpoint_every > 0 && trained - checkpointed >= checkpoint_every) {
+        if (!writer)
+            writer.reset(new CheckpointWriter());
+        if (!writer->busy()) {
+            serialize(writer->acquire());
+            writer->submit(checkpoint_path);
+            checkpointed = trained;
+        } else if(debugging) {
+            cout << "Checkpoint delayed, the previous one is still being written\n";
+        }
+    }
+
+}
+
+void NeuralNetwork::printEpoch(size_t epoch, size_t steps, size_t step_allocs) {
+
+    cout << "Epoch " << epoch + 1 << ": " << correct << " / " << tested;
+    if (allocCountEnabled() && steps > 0)
+        cout << " | " << double(step_allocs) / steps << " allocs/step";
+    cout << "\n";
+
+}
+
+
+// Binary checkpoint (version 2, little-endian):
+//   PsmHeader | PsmLayer x layer_count | PsmState | zero padding | parameter blob at blob_offset
+//   | zero padding | AdamW moments m then v at moments_offset
+// The blob is the parameter arena exactly as it sits in memory, so load can map it in place. Both
+// offsets are 64 byte aligned. Version 1 files have no PsmState and no moments
+static const char psm_magic[4] = {'P', 'S', 'M', 'T'};
+static const uint32_t psm_version = 2;
+
+struct PsmHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t scalar_size;   // 4 (float) or 8 (double)
+    uint32_t layer_count;
+    uint64_t param_count;   // Scalars in the blob
+    uint64_t blob_offset;   // Byte offset of the blob from the start of the file
+};
+
+struct PsmLayer {
+    uint32_t type;          // 0 dense, 1 convolutional, 2 pool
+    char name[12];          // Activation function (pooling mode for pool layers)
+    uint64_t in_rows, in_cols, in_chans;
+    uint64_t out_rows, out_cols, out_chans;
+    uint64_t k_size;
+    uint64_t offset;        // First scalar of the layer in the blob
+};
+
+struct PsmState {
+    uint64_t t;               // AdamW step counter
+    uint64_t epochs;          // Epochs trained so far
+    uint64_t seed;            // Run seed (see BatchLoader::epochSeed)
+    uint64_t descent;         // 0 SGD, 1 AdamW
+    uint64_t moments_offset;  // 0 when the network never trained
+};
+
+static bool littleEndian() {
+
+    const uint16_t one = 1;
+    return *reinterpret_cast<const uint8_t*>(&one) == 1;
+
+}
+
+static PsmLayer describeLayer(Layer* layer, size_t offset) {
+
+    PsmLayer r{};
+    r.in_rows = r.in_cols = r.in_chans = r.out_rows = r.out_cols = r.out_chans = 1;
+    r.offset = offset;
+    string name = layer->a_func_name;
+
+    if (DenseLayer* d = dynamic_cast<DenseLayer*>(layer)) {
+        r.type = 0;
+        r.in_rows = d->in_size;
+        r.out_rows = d->l_size;
+    } else if (ConvoLayer* c = dynamic_cast<ConvoLayer*>(layer)) {
+        r.type = 1;
+        r.in_rows = c->in_rows;
+        r.in_cols = c->in_cols;
+        r.in_chans = c->in_chans;
+        r.out_rows = c->out_rows;
+        r.out_cols = c->out_cols;
+        r.out_chans = c->out_chans;
+        r.k_size = c->k_size;
+    } else if (PoolLayer* p = dynamic_cast<PoolLayer*>(layer)) {
+        r.type = 2;
+        r.in_rows = p->in_rows;
+        r.in_cols = p->in_cols;
+        r.in_chans = r.out_chans = p->chans;
+        r.out_rows = p->out_rows;
+        r.out_cols = p->out_cols;
+        name = p->mode;
+    }
+
+    strncpy(r.name, name.c_str(), sizeof(r.name) - 1);
+    return r;
+
+}
+
+static unique_ptr<Layer> buildLayer(const PsmLayer& r) {
+
+    string name(r.name, strnlen(r.name, sizeof(r.name)));
+
+    switch (r.type) {
+        case 0:
+            return unique_ptr<Layer>(new DenseLayer(r.out_rows, r.in_rows, name));
+        case 1:
+            return unique_ptr<Layer>(new ConvoLayer({r.in_rows, r.in_cols, r.in_chans}, {r.out_rows, r.out_cols, r.out_chans}, name, r.k_size));
+        case 2:
+            return unique_ptr<Layer>(new PoolLayer({r.in_rows, r.in_cols, r.in_chans}, {r.out_rows, r.out_cols, r.in_chans}, name));
+        default:
+            throw runtime_error("Unknown layer type in checkpoint");
+    }
+
+}
+
+void NeuralNetwork::serialize(vector<char>& out) {
+
+    PsmHeader h{};
+    memcpy(h.magic, psm_magic, sizeof(h.magic));
+    h.version = psm_version;
+    h.scalar_size = sizeof(Scalar);
+    h.layer_count = layers.size();
+    h.param_count = params.size();
+
+    const size_t meta = sizeof(PsmHeader) + layers.size() * sizeof(PsmLayer) + sizeof(PsmState);
+    const size_t blob = params.size() * sizeof(Scalar);
+    h.blob_offset = (meta + 63) / 64 * 64;
+
+    PsmState st{t, trained, seed, descent, 0};
+    const bool moments = m.size() == params.size() && v.size() == params.size();
+    if (moments)
+        st.moments_offset = (h.blob_offset + blob + 63) / 64 * 64;
+
+    // Same size on every call, so a reused buffer is only allocated once. Only the padding is zeroed,
+    // everything else gets copied over
+    out.resize(moments ? st.moments_offset + 2 * blob : h.blob_offset + blob);
+    memset(out.data() + meta, 0, h.blob_offset - meta);
+    if (moments)
+        memset(out.data() + h.blob_offset + blob, 0, st.moments_offset - h.blob_offset - blob);
+    char* p = out.data();
+    memcpy(p, &h, sizeof(h));
+    p += sizeof(h);
+    for (size_t l = 0; l < layers.size(); l++) {
+        PsmLayer r = describeLayer(layers[l].get(), offsets[l]);
+        memcpy(p, &r, sizeof(r));
+        p += sizeof(r);
+    }
+    memcpy(p, &st, sizeof(st));
+
+    memcpy(out.data() + h.blob_offset, params.data(), blob);
+    if (moments) {
+        memcpy(out.data() + st.moments_offset, m.data(), blob);
+        memcpy(out.data() + st.moments_offset + blob, v.data(), blob);
+    }
+
+}
 
 void NeuralNetwork::save(const string& fn) {
 
     if(debugging) cout << "Started save\n";
 
+    if (!littleEndian()) {
+        cerr << "Binary checkpoints can only be written on little-endian machines\n";
+        return;
+    }
+
+    // A background save still in flight would otherwise land after this one
+    waitForSave();
+
+    vector<char> image;
+    serialize(image);
+    if (!writeFileAtomic(fn, image))
+        cerr << "Failed writing " << fn << "\n";
+
+    if(debugging) cout << "Finished save\n";
+
+}
+
+void NeuralNetwork::saveAsync(const string& fn) {
+
+    if (!littleEndian()) {
+        cerr << "Binary checkpoints can only be written on little-endian machines\n";
+        return;
+    }
+
+    // Only the snapshot happens here, it waits if the previous checkpoint is still being written
+    if (!writer)
+        writer.reset(new CheckpointWriter());
+    serialize(writer->acquire());
+    writer->submit(fn);
+
+}
+
+void NeuralNetwork::setCheckpoint(const string& fn, size_t every) {
+
+    if (every > 0 && !littleEndian()) {
+        cerr << "Binary checkpoints can only be written on little-endian machines\n";
+        return;
+    }
+
+    checkpoint_path = fn;
+    checkpoint_every = every;
+    checkpointed = trained;
+
+}
+
+void NeuralNetwork::waitForSave() {
+
+    if (writer)
+        writer->wait();
+
+}
+
+size_t NeuralNetwork::epochsTrained() {
+
+    return trained;
+
+}
+
+void NeuralNetwork::load(const string& fn) {
+
+    // Binary checkpoints start with the magic, anything else goes through the text importer
+    ifstream file(fn, ios::binary);
+    if (!file) {
+        cerr << "File couldn't be accessed for loading\n";
+        return;
+    }
+    char magic[4] = {};
+    file.read(magic, sizeof(magic));
+    file.close();
+
+    if (memcmp(magic, psm_magic, sizeof(magic)) == 0)
+        loadBinary(fn);
+    else
+        loadText(fn);
+
+}
+
+void NeuralNetwork::loadBinary(const string& fn) {
+
+    if(debugging) cout << "Started loadBinary\n";
+
+    params_fresh = false;
+
+    if (!littleEndian()) {
+        cerr << "Binary checkpoints can only be read on little-endian machines\n";
+        return;
+    }
+
+    // Map the file copy-on-write, so training a loaded network never touches the file
+    size_t len = 0;
+    char* data = nullptr;
+#ifndef _WIN32
+    int fd = open(fn.c_str(), O_RDONLY);
+    if (fd < 0) {
+        cerr << "File couldn't be accessed for loading\n";
+        return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        len = st.st_size;
+        void* p = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        data = p == MAP_FAILED ? nullptr : static_cast<char*>(p);
+    }
+    close(fd);
+    auto release = [&]() { if (data) munmap(data, len); };
+#else
+    // No mmap here, the file is read once and the parameters are copied out of it
+    ifstream file(fn, ios::binary | ios::ate);
+    vector<char> buf(file ? size_t(file.tellg()) : 0);
+    file.seekg(0);
+    file.read(buf.data(), buf.size());
+    len = buf.size();
+    data = len ? buf.data() : nullptr;
+    auto release = [&]() {};
+#endif
+    if (!data) {
+        cerr << "File couldn't be mapped for loading\n";
+        return;
+    }
+
+    PsmHeader h;
+    bool valid = len >= sizeof(PsmHeader);
+    if (valid) {
+        memcpy(&h, data, sizeof(h));
+        const size_t meta = sizeof(PsmHeader) + size_t(h.layer_count) * sizeof(PsmLayer) + (h.version >= 2 ? sizeof(PsmState) : 0);
+        valid = (h.version == 1 || h.version == psm_version) && (h.scalar_size == 4 || h.scalar_size == 8) && h.layer_count > 0
+            && meta <= len && h.blob_offset >= meta && h.blob_offset % 64 == 0 && h.blob_offset <= len
+            && h.param_count <= (len - h.blob_offset) / h.scalar_size;
+    }
+    PsmState state{};
+    if (valid && h.version >= 2) {
+        memcpy(&state, data + sizeof(PsmHeader) + size_t(h.layer_count) * sizeof(PsmLayer), sizeof(state));
+        valid = state.moments_offset == 0 || (state.moments_offset >= h.blob_offset + h.param_count * h.scalar_size
+            && state.moments_offset <= len && 2 * h.param_count <= (len - state.moments_offset) / h.scalar_size);
+    }
+    if (!valid) {
+        cerr << "Unsupported or corrupt checkpoint: " << fn << "\n";
+        release();
+        return;
+    }
+
+    // Build the new layers before touching the current ones
+    vector<PsmLayer> records(h.layer_count);
+    memcpy(records.data(), data + sizeof(PsmHeader), records.size() * sizeof(PsmLayer));
+    vector<unique_ptr<Layer>> loaded;
+    try {
+        for (size_t l = 0; l < records.size(); l++) {
+            loaded.push_back(buildLayer(records[l]));
+            if (l > 0 && records[l].offset + loaded[l]->paramCount() > h.param_count)
+                throw runtime_error("Layer runs past the end of the blob");
+        }
+    } catch (const exception& e) {
+        cerr << "Unsupported or corrupt checkpoint: " << fn << " (" << e.what() << ")\n";
+        release();
+        return;
+    }
+
+    layers = move(loaded);
+    size_t count = layoutArena();
+    unmap();
+
+    bool in_place = h.scalar_size == sizeof(Scalar) && h.param_count == count;
+    for (size_t l = 1; l < layers.size() && in_place; l++)
+        in_place = records[l].offset == offsets[l];
+#ifdef _WIN32
+    in_place = false;
+#endif
+
+    // Copies every layer of the blob at offset into dst, converting the precision if needed
+    auto copyArena = [&](size_t offset, Scalar* dst) {
+        for (size_t l = 1; l < layers.size(); l++) {
+            const Index n = layers[l]->paramCount();
+            const char* src = data + offset + records[l].offset * h.scalar_size;
+            Map<VectorXs> seg(dst + offsets[l], n);
+            if (h.scalar_size == 4)
+                seg = Map<const VectorXf>(reinterpret_cast<const float*>(src), n).cast<Scalar>();
+            else
+                seg = Map<const VectorXd>(reinterpret_cast<const double*>(src), n).cast<Scalar>();
+        }
+    };
+
+    // The training state is always copied out, the moments change on every step
+    grads.resize(0);
+    m.resize(0);
+    v.resize(0);
+    if (h.version >= 2) {
+        t = state.t;
+        trained = state.epochs;
+        seed = state.seed;
+        descent = state.descent;
+        checkpointed = trained;
+        if (state.moments_offset) {
+            grads = VectorXs::Zero(count);
+            m = VectorXs::Zero(count);
+            v = VectorXs::Zero(count);
+            copyArena(state.moments_offset, m.data());
+            copyArena(state.moments_offset + h.param_count * h.scalar_size, v.data());
+        }
+    }
+
+    if (in_place) {
+        // Zero-copy: the layers view the mapped blob directly
+        mapped = data;
+        mapped_len = len;
+        param_store.resize(0);
+        new (&params) Map<VectorXs>(reinterpret_cast<Scalar*>(data + h.blob_offset), count);
+    } else {
+        // Other precision or arena layout, copy each layer across
+        param_store = VectorXs::Zero(count);
+        new (&params) Map<VectorXs>(param_store.data(), count);
+        copyArena(h.blob_offset, params.data());
+        release();
+    }
+
+    bindLayers();
+
+    if(debugging) cout << "Finished loadBinary\n";
+
+}
+
+void NeuralNetwork::saveText(const string& fn) {
+
+    if(debugging) cout << "Started saveText\n";
+
     // Open/create file
     ofstream file(fn);
     if(!file) {
@@ -211,20 +1014,20 @@ void NeuralNetwork::save(const string& fn) {
         return;
     }
 
-    // Save layer sizes
+    // Save layer sizes (convolution and pooling layers also store their input shape)
     file << layers.size() << "\n";
     for (size_t l = 0; l < layers.size(); l++) {
-        if (dynamic_cast<DenseLayer*>(layers[l].get())) {
-            file << "dense ";
-        } else if (dynamic_cast<ConvoLayer*>(layers[l].get())) {
-            file << "convolutional ";
+        if (DenseLayer* d = dynamic_cast<DenseLayer*>(layers[l].get())) {
+            file << "dense " << d->size().first << " " << d->size().second << " " << d->a_func_name << "\n";
+        } else if (ConvoLayer* c = dynamic_cast<ConvoLayer*>(layers[l].get())) {
+            file << "convolutional " << c->out_rows << " " << c->out_cols << " " << c->a_func_name << " "
+                << c->in_rows << " " << c->in_cols << " " << c->in_chans << " " << c->out_chans << " " << c->k_size << "\n";
+        } else if (PoolLayer* p = dynamic_cast<PoolLayer*>(layers[l].get())) {
+            file << "pool " << p->out_rows << " " << p->out_cols << " " << p->mode << " "
+                << p->in_rows << " " << p->in_cols << " " << p->chans << "\n";
         } else {
-            file << "unknown ";
+            file << "unknown " << layers[l]->size().first << " " << layers[l]->size().second << " " << layers[l]->a_func_name << "\n";
         }
-
-        file << layers[l]->size().first << " ";
-        file << layers[l]->size().second << " ";
-        file << layers[l]->a_func_name << "\n";
     }
     file << "\n";
     
@@ -241,14 +1044,16 @@ void NeuralNetwork::save(const string& fn) {
 
     file.close();
 
-    if(debugging) cout << "Finished save\n";
+    if(debugging) cout << "Finished saveText\n";
 
 }
 
 
-void NeuralNetwork::load(const string& fn) {
+void NeuralNetwork::loadText(const string& fn) {
+
+    if(debugging) cout << "Started loadText\n";
 
-    if(debugging) cout << "Started load\n";
+    params_fresh = false;
 
     // Open File
     ifstream file(fn);
@@ -272,20 +1077,27 @@ void NeuralNetwork::load(const string& fn) {
         file >> lsx;
         file >> lsy;
         file >> afn;
-        if(l == 0) 
+        if(l == 0) {
             layers[l] = unique_ptr<DenseLayer>(new DenseLayer(lsx, 0, afn));
-        else if(lt == "dense")
-            layers[l] = unique_ptr<DenseLayer>(new DenseLayer(lsx, layers[l - 1]->size().first, afn));
-        // else if(lt == "convolutional")
-        //     layers[l] = unique_ptr<ConvoLayer>(new ConvoLayer(lsx, lsy, afn, 3));
-        else
-            layers[l] = unique_ptr<DenseLayer>(new DenseLayer(lsx, layers[l - 1]->size().first, afn));
+        } else if(lt == "convolutional") {
+            size_t ir, ic, ich, och, ks;
+            file >> ir >> ic >> ich >> och >> ks;
+            layers[l] = unique_ptr<ConvoLayer>(new ConvoLayer({ir, ic, ich}, {lsx, lsy, och}, afn, ks));
+        } else if(lt == "pool") {
+            size_t ir, ic, ch;
+            file >> ir >> ic >> ch;
+            layers[l] = unique_ptr<PoolLayer>(new PoolLayer({ir, ic, ch}, {lsx, lsy, ch}, afn));
+        } else {
+            layers[l] = unique_ptr<DenseLayer>(new DenseLayer(lsx, layers[l - 1]->a.rows(), afn));
+        }
     }
 
-    // Load weights
+    buildArena();
+
+    // Load weights (each matrix was written row by row)
     for (size_t l = 1; l < layers.size(); l++) {
-        for (size_t row = 0; row < layers[l]->size().first; row++) {
-            for (size_t col = 0; col < layers[l - 1]->size().first; col++) {
+        for (Index row = 0; row < layers[l]->w.rows(); row++) {
+            for (Index col = 0; col < layers[l]->w.cols(); col++) {
                 file >> layers[l]->w(row, col);  // Read individual element into matrix
             }
         }
@@ -293,14 +1105,63 @@ void NeuralNetwork::load(const string& fn) {
 
     // Load biases
     for (size_t l = 1; l < layers.size(); l++) {
-        for (size_t i = 0; i < layers[l]->size().first; i++) {
+        for (Index i = 0; i < layers[l]->b.size(); i++) {
             file >> layers[l]->b(i);  // Read individual element into vector
         }
     }
 
     file.close();
 
-    if(debugging) cout << "Finished load\n";
+    if(debugging) cout << "Finished loadText\n";
+
+}
+
+Evaluation NeuralNetwork::evaluate(const DataView& X, const DataView& Y, size_t bs) {
+
+    if (X.size != layers[0]->size().first || Y.size != size_t(layers.back()->a.rows())) {
+        cerr << "Evaluation data doesn't match the network's input and output sizes\n";
+        return Evaluation();
+    }
+
+    if (!evaluator || evaluator->size() != threads)
+        evaluator.reset(new Evaluator(threads));
+    Evaluation e = evaluator->run(layers, X, Y, bs);
+    e.epoch = trained;
+    return e;
+
+}
+
+bool NeuralNetwork::evaluateAsync(const DataView& X, const DataView& Y, size_t bs) {
+
+    if (X.size != layers[0]->size().first || Y.size != size_t(layers.back()->a.rows())) {
+        cerr << "Evaluation data doesn't match the network's input and output sizes\n";
+        return false;
+    }
+
+    // One thread, so monitoring takes as little as possible away from training
+    if (!monitor)
+        monitor.reset(new Evaluator(1));
+    return monitor->start(layers, offsets, params.data(), params.size(), X, Y, bs, trained);
+
+}
+
+bool NeuralNetwork::evaluationReady() {
+
+    return monitor && monitor->ready();
+
+}
+
+Evaluation NeuralNetwork::lastEvaluation() {
+
+    return monitor ? monitor->result() : Evaluation();
+
+}
+
+void NeuralNetwork::setMonitor(const DataView& X, const DataView& Y, size_t every) {
+
+    monitor_x = X;
+    monitor_y = Y;
+    monitor_every = every;
 
 }
 
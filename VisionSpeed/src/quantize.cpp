@@ -0,0 +1,103 @@
+// Filename: quantize.cpp
+// Description: Post-training int8 quantization of a trained network
+
+#include "quantize.hpp"
+#include "pseument.hpp"
+
+#include <algorithm>
+
+QuantizedNetwork::QuantizedNetwork(const NeuralNetwork& nn, const DataView& calib, size_t samples, size_t threads) {
+
+    const vector<unique_ptr<Layer>>& src = nn.layers;
+    if (calib.size != size_t(src[0]->a.rows()))
+        throw invalid_argument("Calibration data doesn't match the network's input size");
+
+    // Calibration: the range of every layer's input over samples spread across the whole set
+    const size_t n = min(samples, calib.count);
+    vector<Scalar> lo(src.size(), 0), hi(src.size(), 0);
+    Workspace ws;
+    vector<int> idx;
+    MatrixXs batch;
+    for (size_t first = 0; first < n; first += 250) {
+        const size_t m = min<size_t>(250, n - first);
+        idx.resize(m);
+        for (size_t b = 0; b < m; b++)
+            idx[b] = int((first + b) * calib.count / n);
+        calib.gather(idx.data(), m, batch);
+        nn.forwardBatch(batch, ws);
+        for (size_t l = 1; l < src.size(); l++) {
+            lo[l] = min(lo[l], ws.acts[l - 1].minCoeff());
+            hi[l] = max(hi[l], ws.acts[l - 1].maxCoeff());
+        }
+    }
+
+    float_params.reserve(src.size());
+    layers.push_back(src[0]->clone());
+    for (size_t l = 1; l < src.size(); l++) {
+        const size_t count = src[l]->paramCount();
+        source_bytes += count * sizeof(Scalar);
+        if (const DenseLayer* dense = dynamic_cast<const DenseLayer*>(src[l].get())) {
+            layers.emplace_back(new QuantLayer(*dense, lo[l], hi[l]));
+        } else {
+            float_params.emplace_back(Map<const VectorXs>(nn.params.data() + nn.offsets[l], count));
+            layers.push_back(src[l]->clone());
+            layers.back()->bind(float_params.back().data(), nullptr);
+        }
+    }
+
+    evaluator.reset(new Evaluator(threads));
+
+}
+
+const MatrixXs& QuantizedNetwork::forwardBatch(const Ref<const MatrixXs>& in, Workspace& ws) const {
+
+    if (in.rows() != layers[0]->a.rows())
+        throw invalid_argument("forwardBatch input has " + to_string(in.rows()) + " rows, the network takes " + to_string(layers[0]->a.rows()));
+
+    ws.acts.resize(layers.size());
+    ws.scratch.resize(layers.size());
+    ws.acts[0] = in;
+    for (size_t l = 1; l < layers.size(); ++l)
+        layers[l]->infer(ws.acts[l - 1], ws.acts[l], ws.scratch[l]);
+
+    return ws.acts.back();
+
+}
+
+Evaluation QuantizedNetwork::evaluate(const DataView& X, const DataView& Y, size_t bs) {
+
+    if (X.size != size_t(layers[0]->a.rows()) || Y.size != size_t(layers.back()->a.rows())) {
+        cerr << "Evaluation data doesn't match the network's input and output sizes\n";
+        return Evaluation();
+    }
+
+    return evaluator->run(layers, X, Y, bs);
+
+}
+
+size_t QuantizedNetwork::quantizedLayers() const {
+
+    size_t n = 0;
+    for (const unique_ptr<Layer>& l : layers)
+        n += dynamic_cast<const QuantLayer*>(l.get()) != nullptr;
+    return n;
+
+}
+
+size_t QuantizedNetwork::weightBytes() const {
+
+    size_t bytes = 0;
+    for (const unique_ptr<Layer>& l : layers)
+        if (const QuantLayer* q = dynamic_cast<const QuantLayer*>(l.get()))
+            bytes += q->bytes();
+    for (const VectorXs& p : float_params)
+        bytes += p.size() * sizeof(Scalar);
+    return bytes;
+
+}
+
+size_t QuantizedNetwork::sourceBytes() const {
+
+    return source_bytes;
+
+}
@@ -0,0 +1,349 @@
+// Filename: quantlayer.cpp
+// Description: Int8 dense layer for inference
+
+#include "quantlayer.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define QUANT_X86
+#include <immintrin.h>
+#endif
+
+// out(r, s) = sum over j of w(r, j) * a(j, s) for weight codes w (rows x k, row-major) and input
+// codes a (k x n, one sample per column). k is a multiple of 64 and out is column-major
+typedef void (*QuantKernel)(const int8_t* w, Index rows, Index k, const uint8_t* a, Index n, int32_t* out);
+
+static void gemmPortable(const int8_t* w, Index rows, Index k, const uint8_t* a, Index n, int32_t* out) {
+
+    // Fixed 64 code steps with lane-wise sums, so compilers vectorize it for whatever the target has
+    for (Index r = 0; r < rows; r++) {
+        const int8_t* wr = w + r * k;
+        for (Index s = 0; s < n; s++) {
+            const uint8_t* x = a + s * k;
+            int32_t lanes[64] = {};
+            for (Index j = 0; j < k; j += 64)
+                for (int t = 0; t < 64; t++)
+                    lanes[t] += int32_t(x[j + t]) * int32_t(wr[j + t]);
+            int32_t acc = 0;
+            for (int t = 0; t < 64; t++)
+                acc += lanes[t];
+            out[s * rows + r] = acc;
+        }
+    }
+
+}
+
+#ifdef QUANT_X86
+
+// Samples whose codes stay in L1 while every block of rows goes past them
+static const Index quant_block = 32;
+
+// Rows of a 4 row block, the last block repeats row rows - 1 instead of running past the weights
+static inline void rowBlock(const int8_t* w, Index rows, Index k, Index r, const int8_t** wq) {
+
+    for (Index q = 0; q < 4; q++)
+        wq[q] = w + min(r + q, rows - 1) * k;
+
+}
+
+// Stores the sums of four accumulators, outputs r to r + 3 of one sample (fewer in the last block)
+__attribute__((target("avx2"))) static inline void store4(__m256i c0, __m256i c1, __m256i c2, __m256i c3, int32_t* o, Index valid) {
+
+    const __m256i h = _mm256_hadd_epi32(_mm256_hadd_epi32(c0, c1), _mm256_hadd_epi32(c2, c3));
+    const __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(h), _mm256_extracti128_si256(h, 1));
+    if (valid >= 4) {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(o), sum);
+    } else {
+        alignas(16) int32_t part[4];
+        _mm_store_si128(reinterpret_cast<__m128i*>(part), sum);
+        copy(part, part + valid, o);
+    }
+
+}
+
+// The zero masking forms of the extract (all lanes kept) compile to the same instructions, but unlike the
+// plain forms they don't start from an undefined register, which GCC reports as maybe uninitialized
+__attribute__((target("avx512f"))) static inline __m256i fold(__m512i v) {
+
+    return _mm256_add_epi32(_mm512_maskz_extracti64x4_epi64(0xFF, v, 0), _mm512_maskz_extracti64x4_epi64(0xFF, v, 1));
+
+}
+
+__attribute__((target("avx2"))) static inline __m256i load32(const void* p) {
+
+    return _mm256_loadu_si256(static_cast<const __m256i*>(p));
+
+}
+
+__attribute__((target("avx512f"))) static inline __m512i load64(const void* p) {
+
+    return _mm512_loadu_si512(p);
+
+}
+
+// vpmaddubsw multiplies 32 input and weight codes and adds neighbouring pairs to 16 bits (7 bit inputs
+// keep that exact), vpmaddwd widens them to 32 bits
+__attribute__((target("avx2"))) static inline __m256i dotAvx2(__m256i acc, __m256i x, __m256i w) {
+
+    return _mm256_add_epi32(acc, _mm256_madd_epi16(_mm256_maddubs_epi16(x, w), _mm256_set1_epi16(1)));
+
+}
+
+// Blocks of 4 rows x 2 samples share every load, which fits the 16 AVX2 registers
+__attribute__((target("avx2"))) static void gemmAvx2(const int8_t* w, Index rows, Index k, const uint8_t* a, Index n, int32_t* out) {
+
+    const int8_t* wq[4];
+    for (Index s0 = 0; s0 < n; s0 += quant_block) {
+        const Index s1 = min(n, s0 + quant_block);
+        for (Index r = 0; r < rows; r += 4) {
+            rowBlock(w, rows, k, r, wq);
+            for (Index s = s0; s < s1; s += 2) {
+                // An odd sample at the end of the block is computed twice
+                const uint8_t* x0 = a + s * k;
+                const uint8_t* x1 = a + min(s + 1, s1 - 1) * k;
+                __m256i c00 = _mm256_setzero_si256(), c01 = c00, c02 = c00, c03 = c00;
+                __m256i c10 = c00, c11 = c00, c12 = c00, c13 = c00;
+                for (Index j = 0; j < k; j += 32) {
+                    const __m256i v0 = load32(x0 + j), v1 = load32(x1 + j);
+                    __m256i wv = load32(wq[0] + j);
+                    c00 = dotAvx2(c00, v0, wv);
+                    c10 = dotAvx2(c10, v1, wv);
+                    wv = load32(wq[1] + j);
+                    c01 = dotAvx2(c01, v0, wv);
+                    c11 = dotAvx2(c11, v1, wv);
+                    wv = load32(wq[2] + j);
+                    c02 = dotAvx2(c02, v0, wv);
+                    c12 = dotAvx2(c12, v1, wv);
+                    wv = load32(wq[3] + j);
+                    c03 = dotAvx2(c03, v0, wv);
+                    c13 = dotAvx2(c13, v1, wv);
+                }
+                store4(c00, c01, c02, c03, out + s * rows + r, rows - r);
+                if (s + 1 < s1)
+                    store4(c10, c11, c12, c13, out + (s + 1) * rows + r, rows - r);
+            }
+        }
+    }
+
+}
+
+// vpdpbusd does the multiply, pair sum and accumulate of 64 codes in one instruction, and the 32
+// AVX-512 registers hold blocks of 4 rows x 4 samples
+__attribute__((target("avx2,avx512f,avx512bw,avx512vnni"))) static void gemmVnni(const int8_t* w, Index rows, Index k, const uint8_t* a, Index n, int32_t* out) {
+
+    const int8_t* wq[4];
+    const uint8_t* xs[4];
+    for (Index s0 = 0; s0 < n; s0 += quant_block) {
+        const Index s1 = min(n, s0 + quant_block);
+        for (Index r = 0; r < rows; r += 4) {
+            rowBlock(w, rows, k, r, wq);
+            for (Index s = s0; s < s1; s += 4) {
+                // Samples past the end of the block repeat the last one
+                for (Index i = 0; i < 4; i++)
+                    xs[i] = a + min(s + i, s1 - 1) * k;
+                __m512i c[4][4];
+                for (int i = 0; i < 4; i++)
+                    for (int q = 0; q < 4; q++)
+                        c[i][q] = _mm512_setzero_si512();
+                for (Index j = 0; j < k; j += 64) {
+                    const __m512i v0 = load64(xs[0] + j), v1 = load64(xs[1] + j), v2 = load64(xs[2] + j), v3 = load64(xs[3] + j);
+                    for (int q = 0; q < 4; q++) {
+                        const __m512i wv = load64(wq[q] + j);
+                        c[0][q] = _mm512_dpbusd_epi32(c[0][q], v0, wv);
+                        c[1][q] = _mm512_dpbusd_epi32(c[1][q], v1, wv);
+                        c[2][q] = _mm512_dpbusd_epi32(c[2][q], v2, wv);
+                        c[3][q] = _mm512_dpbusd_epi32(c[3][q], v3, wv);
+                    }
+                }
+                for (Index i = 0; i < 4 && s + i < s1; i++)
+                    store4(fold(c[i][0]), fold(c[i][1]), fold(c[i][2]), fold(c[i][3]), out + (s + i) * rows + r, rows - r);
+            }
+        }
+    }
+
+}
+
+#endif
+
+enum QuantKernelId { k_portable, k_avx2, k_vnni };
+static const char* kernel_names[] = {"portable", "avx2", "vnni"};
+static atomic<int> kernel_id{-1};
+
+static bool kernelSupported(int id) {
+
+#ifdef QUANT_X86
+    __builtin_cpu_init();
+    if (id == k_avx2)
+        return __builtin_cpu_supports("avx2");
+    if (id == k_vnni)
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vnni");
+#endif
+    return id == k_portable;
+
+}
+
+static int currentKernel() {
+
+    int id = kernel_id.load(memory_order_relaxed);
+    if (id < 0) {
+        id = kernelSupported(k_vnni) ? k_vnni : kernelSupported(k_avx2) ? k_avx2 : k_portable;
+        kernel_id.store(id, memory_order_relaxed);
+    }
+    return id;
+
+}
+
+static QuantKernel kernelFunction(int id) {
+
+#ifdef QUANT_X86
+    if (id == k_vnni)
+        return gemmVnni;
+    if (id == k_avx2)
+        return gemmAvx2;
+#endif
+    return gemmPortable;
+
+}
+
+QuantLayer::QuantLayer() {
+
+    a = MatrixXs::Zero(0, 0);
+    dz = MatrixXs::Zero(0, 0);
+
+};
+
+QuantLayer::QuantLayer(const DenseLayer& src, Scalar lo, Scalar hi) : l_size(src.l_size), in_size(src.in_size) {
+
+    k_pad = (in_size + 63) / 64 * 64;
+    setActFunc(src.a_func_name);
+
+    // The input range always holds 0, so an input of 0 (padding, dead units) is exact
+    in_lo = min(lo, Scalar(0));
+    in_hi = max(hi, Scalar(0));
+    if (in_hi - in_lo < Scalar(1e-6))
+        in_hi = in_lo + Scalar(1e-6);
+    in_scale = (in_hi - in_lo) / 127;
+    in_zero = int32_t(min(max(std::round(-in_lo / in_scale), Scalar(0)), Scalar(127)));
+
+    // Symmetric codes per row: the largest weight of the row maps to +-127
+    qw.setZero(l_size, k_pad);
+    row_scale.resize(l_size);
+    row_offset.resize(l_size);
+    for (Index r = 0; r < Index(l_size); r++) {
+        const Scalar top = src.w.row(r).cwiseAbs().maxCoeff();
+        const Scalar w_scale = top > 0 ? top / 127 : Scalar(1);
+        qw.row(r).head(in_size) = (src.w.row(r).array() / w_scale).round().cast<int8_t>();
+        const int32_t sum = qw.row(r).cast<int32_t>().sum();
+        row_scale[r] = in_scale * w_scale;
+        row_offset[r] = src.b(r, 0) - Scalar(in_zero) * Scalar(sum) * row_scale[r];
+    }
+
+    a = MatrixXs::Zero(l_size, 1);
+
+};
+
+void QuantLayer::infer(const MatrixXs& in, MatrixXs& out, MatrixXs& scratch) const {
+
+    const Index n = in.cols();
+
+    // scratch holds the input codes (one padded column per sample) followed by the accumulators
+    const size_t code_bytes = k_pad * n;
+    const size_t bytes = code_bytes + sizeof(int32_t) * l_size * n;
+    scratch.resize((bytes + sizeof(Scalar) - 1) / sizeof(Scalar), 1);
+    uint8_t* codes = reinterpret_cast<uint8_t*>(scratch.data());
+    int32_t* acc = reinterpret_cast<int32_t*>(codes + code_bytes);
+
+    const Scalar inv = 1 / in_scale;
+    for (Index s = 0; s < n; s++) {
+        Map<Array<uint8_t, Dynamic, 1>> c(codes + s * k_pad, in_size);
+        c = (in.col(s).array() * inv + (Scalar(in_zero) + Scalar(0.5))).max(Scalar(0)).min(Scalar(127)).cast<int32_t>().cast<uint8_t>();
+        memset(codes + s * k_pad + in_size, 0, k_pad - in_size);
+    }
+
+    kernelFunction(currentKernel())(qw.data(), l_size, k_pad, codes, n, acc);
+
+    out = (Map<const Matrix<int32_t, Dynamic, Dynamic>>(acc, l_size, n).cast<Scalar>().array().colwise() * row_scale.array()).matrix();
+    biasActivate(out, row_offset);
+
+}
+
+const MatrixXs& QuantLayer::forward(const MatrixXs& in) {
+
+    MatrixXs scratch;
+    infer(in, a, scratch);
+    return a;
+
+}
+
+void QuantLayer::getOutputDeltas(const Ref<const MatrixXs>&) {
+
+    throw logic_error("Quantized layers can't be trained");
+
+}
+
+void QuantLayer::inputGrad(MatrixXs&) {
+
+    throw logic_error("Quantized layers can't be trained");
+
+}
+
+void QuantLayer::updateGrads(const MatrixXs&) {
+
+    throw logic_error("Quantized layers can't be trained");
+
+}
+
+size_t QuantLayer::paramCount() {
+
+    return 0;
+
+}
+
+void QuantLayer::bind(Scalar*, Scalar*) {
+
+}
+
+void QuantLayer::initParams(mt19937&) {
+
+}
+
+pair<size_t, size_t> QuantLayer::size() {
+
+    return {l_size, l_size};
+
+}
+
+unique_ptr<Layer> QuantLayer::clone() const {
+
+    return unique_ptr<Layer>(new QuantLayer(*this));
+
+}
+
+size_t QuantLayer::bytes() const {
+
+    return qw.size() * sizeof(int8_t) + (row_scale.size() + row_offset.size()) * sizeof(Scalar);
+
+}
+
+const char* QuantLayer::kernel() {
+
+    return kernel_names[currentKernel()];
+
+}
+
+bool QuantLayer::useKernel(const string& name) {
+
+    for (int id = k_portable; id <= k_vnni; id++) {
+        if (name == kernel_names[id] && kernelSupported(id)) {
+            kernel_id.store(id, memory_order_relaxed);
+            return true;
+        }
+    }
+    return false;
+
+}
@@ -0,0 +1,252 @@
+// Filename: shardstream.cpp
+// Description: Out of core training data streamed from IDX shards
+
+#include "shardstream.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+#include <stdexcept>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// Reads an IDX header and returns the dimensions, the file is left at the first item
+static vector<size_t> readIdxHeader(FILE* f, const string& path) {
+
+    uint8_t head[4];
+    if (fread(head, 1, 4, f) != 4 || head[0] != 0 || head[1] != 0)
+        throw runtime_error("Not an IDX file: " + path);
+    if (head[2] != 0x08)
+        throw runtime_error("Only unsigned byte IDX data is supported: " + path);
+
+    vector<size_t> dim(head[3]);
+    for (size_t& d : dim) {
+        uint8_t p[4];
+        if (fread(p, 1, 4, f) != 4)
+            throw runtime_error("Truncated IDX header: " + path);
+        d = size_t(p[0]) << 24 | size_t(p[1]) << 16 | size_t(p[2]) << 8 | size_t(p[3]);
+    }
+    if (dim.empty())
+        throw runtime_error("Truncated IDX header: " + path);
+    return dim;
+
+}
+
+void ShardStream::Reader::open(const string& path, long start) {
+
+    close();
+#ifndef _WIN32
+    fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0 || lseek(fd, start, SEEK_SET) != start)
+        throw runtime_error("Cannot open file: " + path);
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+#else
+    file = fopen(path.c_str(), "rb");
+    if (!file || fseek(file, start, SEEK_SET) != 0)
+        throw runtime_error("Cannot open file: " + path);
+#endif
+    pos = len = 0;
+
+}
+
+void ShardStream::Reader::close() {
+
+#ifndef _WIN32
+    if (fd >= 0)
+        ::close(fd);
+    fd = -1;
+#else
+    if (file)
+        fclose(file);
+    file = nullptr;
+#endif
+
+}
+
+void ShardStream::Reader::read(uint8_t* dst, size_t n) {
+
+    while (n > 0) {
+        if (pos == len) {
+#ifndef _WIN32
+            const ssize_t got = ::read(fd, buf.data(), buf.size());
+            len = got > 0 ? size_t(got) : 0;
+#else
+            len = fread(buf.data(), 1, buf.size(), file);
+#endif
+            pos = 0;
+            if (len == 0)
+                throw runtime_error("Shard ended early");
+        }
+        const size_t take = min(n, len - pos);
+        memcpy(dst, buf.data() + pos, take);
+        pos += take;
+        dst += take;
+        n -= take;
+    }
+
+}
+
+ShardStream::ShardStream(size_t classes, size_t buffer, size_t chunk) 
+        : n_classes(classes), capacity(max<size_t>(buffer, 1)), chunk(max<size_t>(chunk, 4096)) {
+
+    images.buf.resize(this->chunk);
+    labels.buf.resize(this->chunk);
+
+}
+
+ShardStream::~ShardStream() {
+
+    images.close();
+    labels.close();
+
+}
+
+void ShardStream::add(const string& image_path, const string& label_path) {
+
+    FILE* fi = fopen(image_path.c_str(), "rb");
+    if (!fi)
+        throw runtime_error("Cannot open file: " + image_path);
+    FILE* fl = fopen(label_path.c_str(), "rb");
+    if (!fl) {
+        fclose(fi);
+        throw runtime_error("Cannot open file: " + label_path);
+    }
+
+    Shard s{image_path, label_path, 0, 0, 0};
+    try {
+        vector<size_t> di = readIdxHeader(fi, image_path);
+        vector<size_t> dl = readIdxHeader(fl, label_path);
+        s.image_start = ftell(fi);
+        s.label_start = ftell(fl);
+
+        size_t size = 1;
+        for (size_t d = 1; d < di.size(); d++)
+            size *= di[d];
+        if (di[0] != dl[0] || dl.size() != 1)
+            throw runtime_error("Labels don't match the images: " + label_path);
+        if (sample_size != 0 && size != sample_size)
+            throw runtime_error("Shard samples differ in size from the others: " + image_path);
+        sample_size = size;
+        s.items = di[0];
+    } catch (...) {
+        fclose(fi);
+        fclose(fl);
+        throw;
+    }
+    fclose(fi);
+    fclose(fl);
+
+    shards.push_back(s);
+    total += s.items;
+
+}
+
+size_t ShardStream::count() const {
+
+    return total;
+
+}
+
+size_t ShardStream::sampleSize() const {
+
+    return sample_size;
+
+}
+
+size_t ShardStream::classes() const {
+
+    return n_classes;
+
+}
+
+bool ShardStream::pull(size_t slot) {
+
+    while (shard_left == 0) {
+        if (shard + 1 >= order.size())
+            return false;
+        shard++;
+        const Shard& s = shards[order[shard]];
+        images.open(s.images, s.image_start);
+        labels.open(s.labels, s.label_start);
+        shard_left = s.items;
+    }
+
+    images.read(pixels.data() + slot * sample_size, sample_size);
+    labels.read(slot_labels.data() + slot, 1);
+    if (slot_labels[slot] >= n_classes)
+        throw runtime_error("Label " + to_string(slot_labels[slot]) + " is out of range for " + to_string(n_classes) + " classes: " + shards[order[shard]].labels);
+    shard_left--;
+    return true;
+
+}
+
+void ShardStream::begin(mt19937& rng) {
+
+    order.resize(shards.size());
+    iota(order.begin(), order.end(), 0);
+    shuffle(order.begin(), order.end(), rng);
+
+    // pull opens order[0] first
+    shard = size_t(-1);
+    shard_left = 0;
+
+    pixels.resize(capacity * sample_size);
+    slot_labels.resize(capacity);
+    held = 0;
+    while (held < capacity && pull(held))
+        held++;
+
+    first_batch = true;
+
+}
+
+bool ShardStream::next(MatrixXs& in, MatrixXs& tg, size_t bs, mt19937& rng) {
+
+    if (held == 0)
+        return false;
+
+    in.resize(sample_size, bs);
+    tg.setZero(n_classes, bs);
+
+    size_t b = 0;
+    for (; b < bs && held > 0; b++) {
+        // Draw a random slot, then put the next sample on disk in its place. Once the shards are
+        // used up the buffer drains by moving its last sample into the gap
+        const size_t j = uniform_int_distribution<size_t>(0, held - 1)(rng);
+        in.col(b) = Map<const Array<uint8_t, Dynamic, 1>>(pixels.data() + j * sample_size, sample_size).cast<Scalar>().matrix() * Scalar(1.0 / 255);
+        tg(slot_labels[j], b) = 1;
+        if (!pull(j)) {
+            held--;
+            memcpy(pixels.data() + j * sample_size, pixels.data() + held * sample_size, sample_size);
+            slot_labels[j] = slot_labels[held];
+        }
+    }
+
+    // The last batch is topped up from the start of the epoch so every step sees a full batch. An
+    // epoch smaller than one batch has no earlier batch, so it cycles through its own samples
+    if (b < bs) {
+        if (first_batch) {
+            for (size_t c = b; c < bs; c++) {
+                in.col(c) = in.col(c % b);
+                tg.col(c) = tg.col(c % b);
+            }
+        } else {
+            in.rightCols(bs - b) = wrap_in.leftCols(bs - b);
+            tg.rightCols(bs - b) = wrap_tg.leftCols(bs - b);
+        }
+    }
+
+    if (first_batch) {
+        wrap_in = in;
+        wrap_tg = tg;
+        first_batch = false;
+    }
+
+    return true;
+
+}
@@ -0,0 +1,78 @@
+// Filename: threadpool.cpp
+// Description: Small fixed size thread pool used for data parallel training
+
+#include "threadpool.hpp"
+
+ThreadPool::ThreadPool(size_t n) {
+
+    for (size_t i = 1; i < n; ++i)
+        workers.emplace_back(&ThreadPool::workerLoop, this);
+
+}
+
+ThreadPool::~ThreadPool() {
+
+    {
+        lock_guard<mutex> lock(mtx);
+        stopping = true;
+    }
+    start_cv.notify_all();
+
+    for (thread& worker : workers)
+        worker.join();
+
+}
+
+void ThreadPool::runTasks(size_t n, void (*inv)(const void*, size_t), const void* j) {
+
+    unique_lock<mutex> lock(mtx);
+    invoke = inv;
+    job = j;
+    tasks = n;
+    next = 0;
+    done = 0;
+    generation++;
+    start_cv.notify_all();
+
+    // The caller takes tasks as well, then waits for the ones still running elsewhere
+    work(lock);
+    done_cv.wait(lock, [this] { return done == tasks; });
+    job = nullptr;
+
+}
+
+size_t ThreadPool::size() const {
+
+    return workers.size() + 1;
+
+}
+
+void ThreadPool::work(unique_lock<mutex>& lock) {
+
+    while (next < tasks) {
+        size_t k = next++;
+        void (*inv)(const void*, size_t) = invoke;
+        const void* j = job;
+        lock.unlock();
+        inv(j, k);
+        lock.lock();
+        if (++done == tasks)
+            done_cv.notify_all();
+    }
+
+}
+
+void ThreadPool::workerLoop() {
+
+    size_t seen = 0;
+    unique_lock<mutex> lock(mtx);
+
+    while (true) {
+        start_cv.wait(lock, [&] { return stopping || generation != seen; });
+        if (stopping)
+            return;
+        seen = generation;
+        work(lock);
+    }
+
+}
@@ -0,0 +1,55 @@
+// Filename: mkcache.cpp
+// Description: Converts IDX datasets into packed dataset caches
+
+#include "datacache.hpp"
+
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+
+using namespace std;
+
+int main(int argc, char* argv[]) {
+
+    if (argc == 3 && string(argv[1]) == "--verify") {
+        try {
+            DataCache cache(argv[2]);
+            const bool ok = cache.verify();
+            cout << argv[2] << ": " << cache.items() << " samples of " << cache.itemSize() << ", "
+                 << (ok ? "checksum ok" : "checksum MISMATCH") << "\n";
+            return ok ? 0 : 1;
+        } catch (const runtime_error& e) {
+            cerr << e.what() << "\n";
+            return 1;
+        }
+    }
+
+    if (argc < 4) {
+        cerr << "Usage: mkcache <images.idx> <labels.idx> <out.psd> [u8|f16] [classes]\n"
+             << "       mkcache --verify <cache.psd>\n";
+        return 1;
+    }
+
+    DataCache::Encoding enc = DataCache::Encoding::u8;
+    if (argc > 4 && string(argv[4]) == "f16")
+        enc = DataCache::Encoding::f16;
+    size_t classes = argc > 5 ? stoul(argv[5]) : 10;
+
+    try {
+        auto start = chrono::steady_clock::now();
+        DataCache::build(argv[1], argv[2], argv[3], classes, enc);
+        DataCache cache(argv[3]);
+        cout << "Wrote " << argv[3] << ": " << cache.items() << " samples of " << cache.itemSize() << " in "
+             << chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() << " ms\n";
+        if (!cache.verify()) {
+            cerr << argv[3] << ": checksum MISMATCH after writing\n";
+            return 1;
+        }
+    } catch (const runtime_error& e) {
+        cerr << e.what() << "\n";
+        return 1;
+    }
+
+    return 0;
+
+}
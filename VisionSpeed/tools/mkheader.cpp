@@ -0,0 +1,248 @@
+// Filename: mkheader.cpp
+// Description: Bakes a dense text checkpoint into a self-contained C++ header
+
+#include <cctype>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Layers with at most this many weights get one statement per output instead of a loop
+const size_t unroll_limit = 512;
+
+struct BakedLayer {
+    size_t in_size, out_size;
+    string act;
+    vector<double> w;    // Row-major, out_size x in_size
+    vector<double> b;
+};
+
+// Reads both text formats: the PongAI/VisionAIDense one ("count size size ...", every layer leaky ReLU)
+// and VisionSpeed's saveText one (a "type rows cols activation ..." line per layer). Only dense layers
+// can be baked. Empty result (with a message) on anything else
+vector<BakedLayer> readCheckpoint(const string& fn) {
+
+    ifstream file(fn);
+    if (!file) {
+        cerr << "File couldn't be accessed for loading\n";
+        return {};
+    }
+
+    char magic[4] = {};
+    file.read(magic, sizeof(magic));
+    if (memcmp(magic, "PSMT", sizeof(magic)) == 0) {
+        cerr << fn << " is a binary checkpoint, save a text copy with NeuralNetwork::saveText first\n";
+        return {};
+    }
+    file.seekg(0);
+
+    size_t count = 0;
+    file >> count;
+    string first;
+    file >> first;
+    if (!file || count < 2) {
+        cerr << fn << " doesn't start with a layer count\n";
+        return {};
+    }
+
+    vector<size_t> sizes(count);
+    vector<string> acts(count, "leakyrelu");
+    if (isdigit(static_cast<unsigned char>(first[0]))) {
+        sizes[0] = stoul(first);
+        for (size_t l = 1; l < count; l++)
+            file >> sizes[l];
+    } else {
+        string type = first;
+        for (size_t l = 0; l < count; l++) {
+            if (l > 0)
+                file >> type;
+            size_t cols;
+            file >> sizes[l] >> cols >> acts[l];
+            if (l > 0 && type != "dense") {
+                cerr << fn << " has a " << type << " layer, only dense networks can be baked\n";
+                return {};
+            }
+            if (acts[l] != "leakyrelu" && acts[l] != "sigmoid" && acts[l] != "tanh" && acts[l] != "linear") {
+                cerr << fn << " uses the unknown activation " << acts[l] << "\n";
+                return {};
+            }
+        }
+    }
+
+    vector<BakedLayer> layers(count - 1);
+    for (size_t l = 1; l < count; l++) {
+        BakedLayer& layer = layers[l - 1];
+        layer.in_size = sizes[l - 1];
+        layer.out_size = sizes[l];
+        layer.act = acts[l];
+        layer.w.resize(layer.out_size * layer.in_size);
+        for (double& v : layer.w)
+            file >> v;
+    }
+    for (BakedLayer& layer : layers) {
+        layer.b.resize(layer.out_size);
+        for (double& v : layer.b)
+            file >> v;
+    }
+    if (!file) {
+        cerr << "Network in " << fn << " is incomplete\n";
+        return {};
+    }
+
+    return layers;
+
+}
+
+// Expression for act applied to x, where x is a variable or array element
+string activation(const string& act, const string& f, const string& x) {
+
+    if (act == "leakyrelu")
+        return x + " > 0.01" + f + " * " + x + " ? " + x + " : 0.01" + f + " * " + x;
+    if (act == "sigmoid")
+        return "1.0" + f + " / (1.0" + f + " + std::exp(-" + x + "))";
+    if (act == "tanh")
+        return "std::tanh(" + x + ")";
+    return x;
+
+}
+
+// Text that reads back to exactly v, always a floating literal (1 becomes 1.0)
+string literal(double v, const string& f) {
+
+    ostringstream text;
+    text.precision(f.empty() ? numeric_limits<double>::max_digits10 : numeric_limits<float>::max_digits10);
+    if (f.empty())
+        text << v;
+    else
+        text << float(v);
+    string s = text.str();
+    if (s.find_first_of(".e") == string::npos)
+        s += ".0";
+    return s + f;
+
+}
+
+void writeValues(ostream& out, const vector<double>& values, size_t per_row, const string& f) {
+
+    for (size_t i = 0; i < values.size(); i++) {
+        out << (i % per_row == 0 ? "\n    " : " ") << literal(values[i], f);
+        if (i + 1 < values.size())
+            out << ",";
+    }
+    out << "\n";
+
+}
+
+void writeHeader(ostream& out, const vector<BakedLayer>& layers, const string& source, const string& ns, const string& type) {
+
+    const string f = type == "float" ? "f" : "";
+    string guard = ns + "_HPP";
+    for (char& c : guard)
+        c = toupper(static_cast<unsigned char>(c));
+    bool needs_cmath = false;
+    for (const BakedLayer& layer : layers)
+        needs_cmath = needs_cmath || layer.act == "sigmoid" || layer.act == "tanh";
+
+    out << "// Generated by mkheader from " << source << ", regenerate instead of editing\n\n"
+        << "#ifndef " << guard << "\n#define " << guard << "\n\n";
+    if (needs_cmath)
+        out << "#include <cmath>\n\n";
+    out << "namespace " << ns << " {\n\n"
+        << "inline constexpr int in_size = " << layers.front().in_size << ";\n"
+        << "inline constexpr int out_size = " << layers.back().out_size << ";\n\n";
+
+    // Weights are stored one row per input (the transpose of the checkpoint), so the loops below add
+    // a whole column into contiguous outputs, which vectorizes without reordering any sum. The arrays
+    // are inline variables (C++17), so a program keeps one copy however many files include the header
+    for (size_t l = 0; l < layers.size(); l++) {
+        const BakedLayer& layer = layers[l];
+        vector<double> w_t(layer.w.size());
+        for (size_t r = 0; r < layer.out_size; r++)
+            for (size_t c = 0; c < layer.in_size; c++)
+                w_t[c * layer.out_size + r] = layer.w[r * layer.in_size + c];
+        out << "// Layer " << l + 1 << ": " << layer.in_size << " -> " << layer.out_size << ", " << layer.act << "\n"
+            << "alignas(64) inline constexpr " << type << " w" << l + 1 << "[" << layer.in_size << "][" << layer.out_size << "] = {";
+        writeValues(out, w_t, layer.out_size, f);
+        out << "};\n"
+            << "alignas(64) inline constexpr " << type << " b" << l + 1 << "[" << layer.out_size << "] = {";
+        writeValues(out, layer.b, 8, f);
+        out << "};\n\n";
+    }
+
+    // Every size is a literal: small layers become one statement per output, larger ones loops with
+    // constant trip counts
+    out << "// in holds in_size values, out receives out_size values\n"
+        << "inline void forward(const " << type << "* in, " << type << "* out) {\n\n";
+    for (size_t l = 0; l < layers.size(); l++) {
+        const BakedLayer& layer = layers[l];
+        const string n = to_string(l + 1);
+        const string src = l == 0 ? "in" : "a" + to_string(l);
+        const string dst = l + 1 == layers.size() ? "out" : "a" + n;
+        if (dst != "out")
+            out << "    alignas(64) " << type << " " << dst << "[" << layer.out_size << "];\n";
+        if (layer.w.size() <= unroll_limit) {
+            for (size_t r = 0; r < layer.out_size; r++) {
+                const string z = "z" + n + "_" + to_string(r);
+                out << "    const " << type << " " << z << " = b" << n << "[" << r << "]";
+                for (size_t c = 0; c < layer.in_size; c++)
+                    out << " + w" << n << "[" << c << "][" << r << "] * " << src << "[" << c << "]";
+                out << ";\n    " << dst << "[" << r << "] = " << activation(layer.act, f, z) << ";\n";
+            }
+        } else {
+            const string rows = to_string(layer.out_size);
+            out << "    for (int r = 0; r < " << rows << "; r++)\n"
+                << "        " << dst << "[r] = b" << n << "[r];\n"
+                << "    for (int c = 0; c < " << layer.in_size << "; c++)\n"
+                << "        for (int r = 0; r < " << rows << "; r++)\n"
+                << "            " << dst << "[r] += w" << n << "[c][r] * " << src << "[c];\n"
+                << "    for (int r = 0; r < " << rows << "; r++)\n"
+                << "        " << dst << "[r] = " << activation(layer.act, f, dst + "[r]") << ";\n";
+        }
+        out << "\n";
+    }
+    out << "}\n\n"
+        << "} // namespace " << ns << "\n\n"
+        << "#endif // " << guard << "\n";
+
+}
+
+int main(int argc, char* argv[]) {
+
+    if (argc < 3) {
+        cerr << "Usage: mkheader <checkpoint.txt> <out.hpp> [namespace] [double|float]\n";
+        return 1;
+    }
+
+    const string ns = argc > 3 ? argv[3] : "baked";
+    const string type = argc > 4 ? argv[4] : "double";
+    if (type != "double" && type != "float") {
+        cerr << "Weights can be baked as double or float, not " << type << "\n";
+        return 1;
+    }
+
+    const vector<BakedLayer> layers = readCheckpoint(argv[1]);
+    if (layers.empty())
+        return 1;
+
+    ofstream out(argv[2]);
+    if (!out) {
+        cerr << "File couldn't be accessed for saving\n";
+        return 1;
+    }
+    string source = argv[1];
+    source = source.substr(source.find_last_of("/\\") + 1);
+    writeHeader(out, layers, source, ns, type);
+
+    size_t params = 0;
+    for (const BakedLayer& layer : layers)
+        params += layer.w.size() + layer.b.size();
+    cout << "Wrote " << argv[2] << ": " << layers.size() << " layers, " << params << " parameters as " << type << "\n";
+
+    return 0;
+
+}
@@ -0,0 +1,46 @@
+// Filename: mkquant.cpp
+// Description: Quantizes a trained network to int8 and reports what it costs
+
+#include "datacache.hpp"
+#include "pseument.hpp"
+
+#include <chrono>
+#include <iostream>
+
+using namespace std;
+
+int main(int argc, char* argv[]) {
+
+    if (argc < 3) {
+        cerr << "Usage: mkquant <checkpoint> <test.psd> [calibration.psd] [samples] [threads]\n";
+        return 1;
+    }
+
+    NeuralNetwork nn({MakeLayer("dense", "linear", {1})});
+    nn.load(argv[1]);
+    DataCache test(argv[2]);
+    DataCache calib(argc > 3 ? argv[3] : argv[2]);
+    const size_t samples = argc > 4 ? stoul(argv[4]) : 2000;
+    const size_t threads = argc > 5 ? stoul(argv[5]) : 1;
+    nn.setThreads(threads);
+
+    auto start = chrono::steady_clock::now();
+    QuantizedNetwork q(nn, calib.view(), samples, threads);
+    cout << "Quantized " << q.quantizedLayers() << " dense layers in "
+         << chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() << " ms ("
+         << QuantLayer::kernel() << " kernel)\n";
+    cout << "Weights: " << q.weightBytes() << " bytes, " << q.sourceBytes() << " in the source network ("
+         << double(q.sourceBytes()) / q.weightBytes() << "x smaller)\n";
+
+    Evaluation full = nn.evaluate(test.view(), test.oneHot());
+    Evaluation quant = q.evaluate(test.view(), test.oneHot());
+    cout << "Source:    ";
+    full.print();
+    cout << "Quantized: ";
+    quant.print();
+    cout << "Accuracy delta " << (quant.accuracy - full.accuracy) * 100 << " points, "
+         << quant.samples_per_sec / full.samples_per_sec << "x the throughput\n";
+
+    return 0;
+
+}